@@ -136,6 +136,7 @@ def register_properties():
     bpy.types.Scene.num_samples = IntProperty(min=3,max=10,default=5)
     bpy.types.Scene.max_threads = IntProperty(min=0,max=1000,default=num_threads)
     bpy.types.Scene.debug_dir = StringProperty(name="Path", description="Directory for debug output", subtype='DIR_PATH')
+    bpy.types.Scene.cache_dir = StringProperty(name="Path", description="Directory for caching acceleration structures", subtype='DIR_PATH')
     bpy.types.Scene.ear_exec_path = StringProperty(name="Path", description="Path to the EAR executable", subtype='FILE_PATH')
     
     setup_exec_path()
@@ -217,6 +218,8 @@ def export(filename):
     settings = ['debug',0,'absorption',[scn.ab_low,scn.ab_mid,scn.ab_high],'drylevel',scn.drylevel,'samples',10 ** scn.num_samples,'maxthreads',scn.max_threads]
     debug_dir = normpath(abspath(scn.debug_dir))
     if debug_dir != '.' and os.path.exists(debug_dir): settings.extend(['debugdir',debug_dir])
+    cache_dir = normpath(abspath(scn.cache_dir))
+    if cache_dir != '.' and os.path.exists(cache_dir): settings.extend(['cachedir',cache_dir])
     writeblock('SET ',settings)
     
     # A function to determines whether ob has suitable fcurves or its parent object
@@ -604,6 +607,8 @@ class EAR_Panel_Render(bpy.types.Panel):
         layout.prop(rd,"drylevel","Dry level")
         layout = self.layout.row(True)
         layout.prop(rd,"debug_dir","Debug dir")
+        layout = self.layout.row(True)
+        layout.prop(rd,"cache_dir","Cache dir")
         layout = self.layout.row()
         layout.prop(rd,"max_threads","Threads")
         layout = self.layout.row()
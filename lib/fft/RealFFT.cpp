@@ -0,0 +1,238 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <cmath>
+
+#include "RealFFT.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+RealFFT::RealFFT(unsigned int l) : n(l) {
+	// Sequences of even length are transformed as complex sequences of half
+	// the length, those of odd length as complex sequences of equal length.
+	m = n % 2 ? n : n / 2;
+
+	// The radices of the stages, in the order in which they are applied
+	unsigned int r = m;
+	std::vector<unsigned int> radices;
+	while ( r % 4 == 0 ) { radices.push_back(4); r /= 4; }
+	while ( r % 2 == 0 ) { radices.push_back(2); r /= 2; }
+	for ( unsigned int p = 3; r > 1; p += 2 ) {
+		while ( r % p == 0 ) { radices.push_back(p); r /= p; }
+	}
+
+	// The twiddle factors of stage s are w^(j*t) for 0 <= j < L/p and
+	// 1 <= t < p, where L is the length of the sub-transforms of the
+	// stage and w = exp(-2 pi i / L). The roots are exp(-2 pi i k / p),
+	// which are only stored for the radices without a dedicated butterfly.
+	unsigned int L = m;
+	for ( unsigned int s = 0; s < radices.size(); ++ s ) {
+		const unsigned int p = radices[s];
+		Stage stage;
+		stage.radix = p;
+		stage.twiddles = (unsigned int) twiddle_re.size();
+		stage.roots = (unsigned int) root_re.size();
+		const unsigned int mm = L / p;
+		for ( unsigned int j = 0; j < mm; ++ j ) {
+			for ( unsigned int t = 1; t < p; ++ t ) {
+				const double a = -2.0 * M_PI * (double) (j * t) / (double) L;
+				twiddle_re.push_back((float) cos(a));
+				twiddle_im.push_back((float) sin(a));
+			}
+		}
+		if ( p > 4 || p == 3 ) {
+			for ( unsigned int k = 0; k < p; ++ k ) {
+				const double a = -2.0 * M_PI * (double) k / (double) p;
+				root_re.push_back((float) cos(a));
+				root_im.push_back((float) sin(a));
+			}
+		}
+		stages.push_back(stage);
+		L = mm;
+	}
+
+	// The factors exp(-2 pi i k / n) that combine the transform of the
+	// even and odd samples into the transform of a sequence of even length
+	if ( n % 2 == 0 ) {
+		for ( unsigned int k = 0; k <= m; ++ k ) {
+			const double a = -2.0 * M_PI * (double) k / (double) n;
+			post_re.push_back((float) cos(a));
+			post_im.push_back((float) sin(a));
+		}
+	}
+}
+
+void RealFFT::Transform(float* x_re, float* x_im, float* y_re, float* y_im) const {
+	float* const re = x_re;
+	float* const im = x_im;
+	unsigned int L = m;
+	unsigned int s = 1;
+	for ( std::vector<Stage>::const_iterator it = stages.begin(); it != stages.end(); ++ it ) {
+		const unsigned int p = it->radix;
+		const unsigned int mm = L / p;
+		const float* w_re = &twiddle_re[0] + it->twiddles;
+		const float* w_im = &twiddle_im[0] + it->twiddles;
+		if ( p == 4 ) {
+			for ( unsigned int j = 0; j < mm; ++ j ) {
+				const float w1r = w_re[3*j], w1i = w_im[3*j];
+				const float w2r = w_re[3*j+1], w2i = w_im[3*j+1];
+				const float w3r = w_re[3*j+2], w3i = w_im[3*j+2];
+				const unsigned int i0 = s*j, i1 = s*(j+mm), i2 = s*(j+2*mm), i3 = s*(j+3*mm);
+				const unsigned int o0 = s*4*j, o1 = o0+s, o2 = o1+s, o3 = o2+s;
+				for ( unsigned int q = 0; q < s; ++ q ) {
+					const float t0r = x_re[i0+q] + x_re[i2+q], t0i = x_im[i0+q] + x_im[i2+q];
+					const float t1r = x_re[i0+q] - x_re[i2+q], t1i = x_im[i0+q] - x_im[i2+q];
+					const float t2r = x_re[i1+q] + x_re[i3+q], t2i = x_im[i1+q] + x_im[i3+q];
+					const float t3r = x_re[i1+q] - x_re[i3+q], t3i = x_im[i1+q] - x_im[i3+q];
+					const float b1r = t1r + t3i, b1i = t1i - t3r;
+					const float b2r = t0r - t2r, b2i = t0i - t2i;
+					const float b3r = t1r - t3i, b3i = t1i + t3r;
+					y_re[o0+q] = t0r + t2r;
+					y_im[o0+q] = t0i + t2i;
+					y_re[o1+q] = b1r * w1r - b1i * w1i;
+					y_im[o1+q] = b1r * w1i + b1i * w1r;
+					y_re[o2+q] = b2r * w2r - b2i * w2i;
+					y_im[o2+q] = b2r * w2i + b2i * w2r;
+					y_re[o3+q] = b3r * w3r - b3i * w3i;
+					y_im[o3+q] = b3r * w3i + b3i * w3r;
+				}
+			}
+		} else if ( p == 2 ) {
+			for ( unsigned int j = 0; j < mm; ++ j ) {
+				const float wr = w_re[j], wi = w_im[j];
+				const unsigned int i0 = s*j, i1 = s*(j+mm);
+				const unsigned int o0 = s*2*j, o1 = o0+s;
+				for ( unsigned int q = 0; q < s; ++ q ) {
+					const float br = x_re[i0+q] - x_re[i1+q], bi = x_im[i0+q] - x_im[i1+q];
+					y_re[o0+q] = x_re[i0+q] + x_re[i1+q];
+					y_im[o0+q] = x_im[i0+q] + x_im[i1+q];
+					y_re[o1+q] = br * wr - bi * wi;
+					y_im[o1+q] = br * wi + bi * wr;
+				}
+			}
+		} else {
+			// A direct transform of length p for the remaining radices
+			const float* r_re = &root_re[0] + it->roots;
+			const float* r_im = &root_im[0] + it->roots;
+			for ( unsigned int j = 0; j < mm; ++ j ) {
+				for ( unsigned int t = 0; t < p; ++ t ) {
+					const float wr = t ? w_re[(p-1)*j+t-1] : 1.0f;
+					const float wi = t ? w_im[(p-1)*j+t-1] : 0.0f;
+					const unsigned int o = s*(p*j+t);
+					for ( unsigned int q = 0; q < s; ++ q ) {
+						float br = 0.0f, bi = 0.0f;
+						for ( unsigned int k = 0; k < p; ++ k ) {
+							const unsigned int i = s*(j+k*mm)+q;
+							const unsigned int e = (k*t) % p;
+							br += x_re[i] * r_re[e] - x_im[i] * r_im[e];
+							bi += x_re[i] * r_im[e] + x_im[i] * r_re[e];
+						}
+						y_re[o+q] = br * wr - bi * wi;
+						y_im[o+q] = br * wi + bi * wr;
+					}
+				}
+			}
+		}
+		float* t;
+		t = x_re; x_re = y_re; y_re = t;
+		t = x_im; x_im = y_im; y_im = t;
+		L = mm;
+		s *= p;
+	}
+	if ( x_re != re ) {
+		for ( unsigned int i = 0; i < m; ++ i ) {
+			re[i] = x_re[i];
+			im[i] = x_im[i];
+		}
+	}
+}
+
+void RealFFT::Forward(const float* in, float* out, float* work) const {
+	float* re = work;
+	float* im = work + m;
+	if ( n % 2 ) {
+		for ( unsigned int i = 0; i < n; ++ i ) {
+			re[i] = in[i];
+			im[i] = 0.0f;
+		}
+		Transform(re,im,work+2*m,work+3*m);
+		for ( unsigned int k = 0; k <= n/2; ++ k ) {
+			out[2*k] = re[k];
+			out[2*k+1] = im[k];
+		}
+		return;
+	}
+	for ( unsigned int i = 0; i < m; ++ i ) {
+		re[i] = in[2*i];
+		im[i] = in[2*i+1];
+	}
+	Transform(re,im,work+2*m,work+3*m);
+	// The transforms of the even samples E and odd samples O are separated
+	// from the transform Z of the complex sequence and combined as
+	// X[k] = E[k] + exp(-2 pi i k / n) O[k].
+	for ( unsigned int k = 0; k <= m; ++ k ) {
+		const unsigned int a = k % m, b = (m - k) % m;
+		const float er = 0.5f * (re[a] + re[b]), ei = 0.5f * (im[a] - im[b]);
+		const float or_ = 0.5f * (im[a] + im[b]), oi = -0.5f * (re[a] - re[b]);
+		out[2*k] = er + or_ * post_re[k] - oi * post_im[k];
+		out[2*k+1] = ei + or_ * post_im[k] + oi * post_re[k];
+	}
+}
+
+void RealFFT::Inverse(const float* in, float* out, float* work) const {
+	// The inverse transform is calculated as the conjugate of the forward
+	// transform of the conjugate.
+	float* re = work;
+	float* im = work + m;
+	if ( n % 2 ) {
+		for ( unsigned int k = 0; k <= n/2; ++ k ) {
+			re[k] = in[2*k];
+			im[k] = -in[2*k+1];
+			if ( k ) {
+				re[n-k] = in[2*k];
+				im[n-k] = in[2*k+1];
+			}
+		}
+		Transform(re,im,work+2*m,work+3*m);
+		for ( unsigned int i = 0; i < n; ++ i ) {
+			out[i] = re[i];
+		}
+		return;
+	}
+	// The transform Z of the complex sequence of the even and odd samples
+	// is recovered as Z[k] = 2 E[k] + 2 i O[k].
+	for ( unsigned int k = 0; k < m; ++ k ) {
+		const float ar = in[2*k], ai = in[2*k+1];
+		const float br = in[2*(m-k)], bi = -in[2*(m-k)+1];
+		const float er = ar + br, ei = ai + bi;
+		const float dr = ar - br, di = ai - bi;
+		// (dr + i di) exp(2 pi i k / n)
+		const float or_ = dr * post_re[k] + di * post_im[k];
+		const float oi = di * post_re[k] - dr * post_im[k];
+		re[k] = er - oi;
+		im[k] = -(ei + or_);
+	}
+	Transform(re,im,work+2*m,work+3*m);
+	for ( unsigned int i = 0; i < m; ++ i ) {
+		out[2*i] = re[i];
+		out[2*i+1] = -im[i];
+	}
+}
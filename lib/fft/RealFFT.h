@@ -0,0 +1,68 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+// Mixed radix Stockham autosort Fast Fourier Transform, after:
+// C. Van Loan, Computational Frameworks for the Fast Fourier Transform
+
+#ifndef REALFFT_H
+#define REALFFT_H
+
+#include <vector>
+
+/// A Fast Fourier Transform of real sequences of a fixed length n. A real
+/// sequence of even length is transformed as a complex sequence of half the
+/// length. The complex transform is factored into stages of radix 4, 2, 3,
+/// 5 and 7, lengths with other prime factors are supported at a higher cost.
+/// The stages are ordered such that no bit reversal is needed and the inner
+/// loops run over contiguous arrays of real and imaginary parts, which the
+/// compiler vectorizes. Complex numbers are stored as pairs of floats, the
+/// same layout as fftwf_complex. A RealFFT can be used by multiple threads
+/// simultaneously, as long as every thread passes its own work array.
+class RealFFT {
+private:
+	struct Stage {
+		unsigned int radix;
+		unsigned int twiddles;
+		unsigned int roots;
+	};
+	unsigned int n;
+	unsigned int m;
+	std::vector<Stage> stages;
+	std::vector<float> twiddle_re, twiddle_im;
+	std::vector<float> root_re, root_im;
+	std::vector<float> post_re, post_im;
+	/// Transforms the m complex numbers in re and im in place, using the
+	/// arrays in work_re and work_im.
+	void Transform(float* re, float* im, float* work_re, float* work_im) const;
+public:
+	/// Prepares the transforms of length n
+	RealFFT(unsigned int n);
+	/// The length of the real sequences
+	unsigned int size() const { return n; }
+	/// The number of floats in the work array passed to the transforms
+	unsigned int workSize() const { return 4 * m; }
+	/// Transforms n real numbers in in to n/2+1 complex numbers in out.
+	void Forward(const float* in, float* out, float* work) const;
+	/// Transforms n/2+1 complex numbers in in to n real numbers in out. The
+	/// result is not normalized, i.e. it is n times the sequence that was
+	/// transformed by Forward().
+	void Inverse(const float* in, float* out, float* work) const;
+};
+
+#endif
@@ -0,0 +1,738 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "SIMD.h"
+#include "BVH.h"
+
+// The number of bins along each axis used to evaluate the Surface Area
+// Heuristic. Binning rather than sorting all triangles along all axes
+// keeps the build at O(n log n) at a negligible loss in quality.
+#define SAH_BINS 16
+// The cost of traversing a node relative to intersecting a triangle
+#define SAH_TRAVERSAL_COST 1.0f
+// Nodes with this amount of triangles or less always become a leaf
+#define MIN_LEAF_SIZE 4
+// Nodes with more triangles than this are always split, regardless of
+// the Surface Area Heuristic
+#define MAX_LEAF_SIZE 16
+// Beyond this depth nodes are split at the median, which bounds the
+// depth of the tree and hence the size of the traversal stack.
+#define MAX_SAH_DEPTH 64
+#define TRAVERSAL_STACK_SIZE 128
+// Identifies cache files written by BVH::Save(). The version needs to be
+// incremented whenever the node layout or the build algorithm changes.
+#define CACHE_MAGIC "EAR BVH"
+#define CACHE_VERSION 1
+
+struct BVH::BuildItem {
+	float min[3];
+	float max[3];
+	float centroid[3];
+	Triangle* triangle;
+	unsigned int index;
+};
+
+// The header of a cache file, which is followed by the nodes and by the
+// permutation of the triangles. The header is padded to 64 bytes, which
+// keeps the nodes in a mapped file aligned.
+struct CacheHeader {
+	char magic[8];
+	boost::uint32_t version;
+	boost::uint32_t node_size;
+	boost::uint64_t hash;
+	boost::uint32_t triangle_count;
+	boost::uint32_t node_count;
+	boost::int32_t depth;
+	boost::int32_t leaf_count;
+	char padding[24];
+};
+
+namespace {
+	struct Bounds {
+		float min[3];
+		float max[3];
+		Bounds() {
+			min[0] = min[1] = min[2] = 1e30f;
+			max[0] = max[1] = max[2] = -1e30f;
+		}
+		void Extend(const float* mi, const float* ma) {
+			for ( int i = 0; i < 3; ++ i ) {
+				if ( mi[i] < min[i] ) min[i] = mi[i];
+				if ( ma[i] > max[i] ) max[i] = ma[i];
+			}
+		}
+		void Extend(const Bounds& b) {
+			Extend(b.min,b.max);
+		}
+		float Area() const {
+			const float dx = max[0] - min[0];
+			const float dy = max[1] - min[1];
+			const float dz = max[2] - min[2];
+			if ( dx < 0.0f || dy < 0.0f || dz < 0.0f ) return 0.0f;
+			return 2.0f * (dx*dy + dy*dz + dz*dx);
+		}
+	};
+
+	struct CentroidBelow {
+		int axis;
+		float split;
+		CentroidBelow(int a, float s) : axis(a), split(s) {}
+		template <typename T>
+		bool operator()(const T& i) const {
+			return i.centroid[axis] < split;
+		}
+	};
+
+	struct CentroidLess {
+		int axis;
+		CentroidLess(int a) : axis(a) {}
+		template <typename T>
+		bool operator()(const T& a, const T& b) const {
+			return a.centroid[axis] < b.centroid[axis];
+		}
+	};
+
+	// Returns the parametric interval in which the ray overlaps the box
+	// clipped to (0,t), the reciprocal direction of the ray is passed
+	// to prevent a division for every node.
+	inline bool IntersectBox(const BVHNode& n, const float* o, const float* inv, float t) {
+		float tmin = 0.0f;
+		float tmax = t;
+		for ( int i = 0; i < 3; ++ i ) {
+			float t0 = (n.min[i] - o[i]) * inv[i];
+			float t1 = (n.max[i] - o[i]) * inv[i];
+			if ( inv[i] < 0.0f ) std::swap(t0,t1);
+			if ( t0 > tmin ) tmin = t0;
+			if ( t1 < tmax ) tmax = t1;
+		}
+		return tmin <= tmax;
+	}
+
+	// Computes the reciprocal of the ray direction for the slab test.
+	inline void PrepareRay(const gmtl::Rayf& r, float* o, float* inv, bool* negative) {
+		for ( int i = 0; i < 3; ++ i ) {
+			// Prevent infinities, and hence NaNs in the slab test, for
+			// direction components that are zero.
+			float d = r.mDir[i];
+			if ( fabs(d) < 1e-20f ) d = d < 0.0f ? -1e-20f : 1e-20f;
+			o[i] = r.mOrigin[i];
+			inv[i] = 1.0f / d;
+			negative[i] = d < 0.0f;
+		}
+	}
+
+	// The rays of a packet in a structure of arrays layout, so that the
+	// same component of multiple rays can be loaded in a single instruction.
+	// Unused lanes have a negative maximum distance, which fails the slab
+	// test for every node.
+	struct Packet {
+		float o[3][MAX_PACKET_SIZE];
+		float inv[3][MAX_PACKET_SIZE];
+		bool negative[3][MAX_PACKET_SIZE];
+		float t[MAX_PACKET_SIZE];
+		Packet() {
+			for ( int j = 0; j < MAX_PACKET_SIZE; ++ j ) {
+				for ( int i = 0; i < 3; ++ i ) {
+					o[i][j] = 0.0f;
+					inv[i][j] = 1.0f;
+					negative[i][j] = false;
+				}
+				t[j] = -1.0f;
+			}
+		}
+		void Set(int j, const gmtl::Rayf& r, float max_t) {
+			float oj[3], invj[3];
+			bool negj[3];
+			PrepareRay(r,oj,invj,negj);
+			for ( int i = 0; i < 3; ++ i ) {
+				o[i][j] = oj[i];
+				inv[i][j] = invj[i];
+				negative[i][j] = negj[i];
+			}
+			t[j] = max_t;
+		}
+	};
+
+	// Returns a bit mask of the rays in the packet that intersect the box,
+	// only the rays in active are tested. Per ray the outcome is identical
+	// to that of IntersectBox().
+#ifdef SIMD_SSE
+	template <typename L>
+	inline int IntersectBoxPacket(const BVHNode& n, const Packet& p, int size, int active) {
+		typedef typename L::type T;
+		const T zero = L::set(0.0f);
+		const int lanes = (1 << L::width) - 1;
+		int mask = 0;
+		for ( int j = 0; j < size; j += L::width ) {
+			if ( !((active >> j) & lanes) ) continue;
+			T tmin = zero;
+			T tmax = L::loadu(p.t+j);
+			for ( int i = 0; i < 3; ++ i ) {
+				const T o = L::loadu(p.o[i]+j);
+				const T inv = L::loadu(p.inv[i]+j);
+				const T t0 = L::mul(L::sub(L::set(n.min[i]),o),inv);
+				const T t1 = L::mul(L::sub(L::set(n.max[i]),o),inv);
+				tmin = L::max(tmin,L::min(t0,t1));
+				tmax = L::min(tmax,L::max(t0,t1));
+			}
+			mask |= L::mask(L::le(tmin,tmax)) << j;
+		}
+		return mask & active;
+	}
+#else
+	template <typename L>
+	inline int IntersectBoxPacket(const BVHNode& n, const Packet& p, int size, int active) {
+		int mask = 0;
+		for ( int j = 0; j < size; ++ j ) {
+			if ( !(active & (1 << j)) ) continue;
+			const float o[3] = {p.o[0][j],p.o[1][j],p.o[2][j]};
+			const float inv[3] = {p.inv[0][j],p.inv[1][j],p.inv[2][j]};
+			if ( IntersectBox(n,o,inv,p.t[j]) ) mask |= 1 << j;
+		}
+		return mask;
+	}
+#endif
+
+	inline int IntersectBoxPacket(const BVHNode& n, const Packet& p, int size, int active) {
+#if defined(SIMD_AVX)
+		return IntersectBoxPacket<AVXLanes>(n,p,size,active);
+#elif defined(SIMD_SSE)
+		return IntersectBoxPacket<SSELanes>(n,p,size,active);
+#else
+		return IntersectBoxPacket<void>(n,p,size,active);
+#endif
+	}
+
+	// An entry on the traversal stack of a packet, holding the rays in the
+	// packet that intersect the parent of the node. Only these rays can
+	// intersect the node itself.
+	struct PacketItem {
+		unsigned int node;
+		int active;
+		PacketItem() {}
+		PacketItem(unsigned int n, int a) : node(n), active(a) {}
+	};
+
+	inline int FirstBit(int mask) {
+		int i = 0;
+		while ( !(mask & (1 << i)) ) ++ i;
+		return i;
+	}
+
+	// Walks the nodes of a hierarchy read from a cache file once, to check
+	// that they form a tree in depth-first order of which the children lie
+	// within the nodes and the leaves within the triangles, so that the
+	// traversal never reads outside of them. The depth of the tree is
+	// returned in depth, which needs to fit in the traversal stack.
+	bool ValidNodes(const BVHNode* nodes, unsigned int node_count, unsigned int triangle_count, int& depth) {
+		depth = 0;
+		if ( !node_count ) return triangle_count == 0;
+		std::vector< std::pair<unsigned int,int> > stack;
+		stack.push_back(std::make_pair(0u,1));
+		unsigned int visited = 0;
+		while ( !stack.empty() ) {
+			const unsigned int index = stack.back().first;
+			const int level = stack.back().second;
+			stack.pop_back();
+			if ( ++ visited > node_count || level >= TRAVERSAL_STACK_SIZE ) return false;
+			if ( level > depth ) depth = level;
+			const BVHNode& node = nodes[index];
+			if ( node.count ) {
+				if ( node.offset > triangle_count || node.count > triangle_count - node.offset ) return false;
+			} else {
+				// The second child follows the subtree of the first child
+				if ( node.axis > 2 || index + 1 >= node_count ||
+					node.offset <= index + 1 || node.offset >= node_count ) return false;
+				stack.push_back(std::make_pair(node.offset,level + 1));
+				stack.push_back(std::make_pair(index + 1,level + 1));
+			}
+		}
+		return visited == node_count;
+	}
+}
+
+BVH::BVH() {
+	node_data = 0;
+	node_count = 0;
+	region = 0;
+	depth = leaf_count = 0;
+}
+
+BVH::BVH(const std::vector<Triangle*>& tris) {
+	node_data = 0;
+	node_count = 0;
+	region = 0;
+	depth = leaf_count = 0;
+	if ( tris.empty() ) return;
+
+	std::vector<BuildItem> items(tris.size());
+	for ( unsigned int i = 0; i < tris.size(); ++ i ) {
+		BuildItem& item = items[i];
+		const Triangle& t = *tris[i];
+		for ( int j = 0; j < 3; ++ j ) {
+			item.min[j] = (std::min)(t[0][j],(std::min)(t[1][j],t[2][j]));
+			item.max[j] = (std::max)(t[0][j],(std::max)(t[1][j],t[2][j]));
+			item.centroid[j] = (item.min[j] + item.max[j]) * 0.5f;
+		}
+		item.triangle = tris[i];
+		item.index = i;
+	}
+
+	// A binary tree with at most one triangle per leaf has 2n-1 nodes,
+	// reserving this upfront keeps references to nodes valid during
+	// the build.
+	nodes.reserve(2 * items.size());
+	triangles.reserve(items.size());
+	permutation.reserve(items.size());
+	nodes.push_back(BVHNode());
+	Build(items,0,0,(unsigned int)items.size(),1);
+
+	// Axis aligned triangles result in boxes without volume, the boxes
+	// are padded slightly to be robust against rounding errors in the
+	// slab test.
+	const BVHNode& root = nodes[0];
+	const float dx = root.max[0] - root.min[0];
+	const float dy = root.max[1] - root.min[1];
+	const float dz = root.max[2] - root.min[2];
+	const float padding = sqrt(dx*dx + dy*dy + dz*dz) * 1e-5f + 1e-6f;
+	for ( std::vector<BVHNode>::iterator it = nodes.begin(); it != nodes.end(); ++ it ) {
+		for ( int i = 0; i < 3; ++ i ) {
+			it->min[i] -= padding;
+			it->max[i] += padding;
+		}
+	}
+	node_data = &nodes[0];
+	node_count = (unsigned int) nodes.size();
+}
+
+BVH::~BVH() {
+	delete region;
+}
+
+boost::uint64_t BVH::Hash(const std::vector<Triangle*>& tris) {
+	// 64-bit FNV-1a over the binary representation of the vertices
+	boost::uint64_t h = 14695981039346656037ULL;
+	const boost::uint32_t count = (boost::uint32_t) tris.size();
+	const unsigned char* c = (const unsigned char*) &count;
+	for ( unsigned int i = 0; i < sizeof(count); ++ i ) {
+		h = (h ^ c[i]) * 1099511628211ULL;
+	}
+	for ( std::vector<Triangle*>::const_iterator it = tris.begin(); it != tris.end(); ++ it ) {
+		const Triangle& t = **it;
+		for ( int i = 0; i < 3; ++ i ) {
+			const float v[3] = {t[i][0],t[i][1],t[i][2]};
+			c = (const unsigned char*) v;
+			for ( unsigned int j = 0; j < sizeof(v); ++ j ) {
+				h = (h ^ c[j]) * 1099511628211ULL;
+			}
+		}
+	}
+	return h;
+}
+
+bool BVH::Save(const std::string& filename, boost::uint64_t hash) const {
+	CacheHeader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,CACHE_MAGIC,sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.node_size = sizeof(BVHNode);
+	header.hash = hash;
+	header.triangle_count = (boost::uint32_t) permutation.size();
+	header.node_count = node_count;
+	header.depth = depth;
+	header.leaf_count = leaf_count;
+
+	// The file is written under a temporary name and renamed afterwards,
+	// so that concurrent runs never map a partially written file.
+	const std::string temp = filename + ".tmp";
+	{std::ofstream f(temp.c_str(),std::ios::binary);
+	if ( !f.good() ) return false;
+	f.write((const char*) &header,sizeof(header));
+	if ( node_count ) f.write((const char*) node_data,node_count * sizeof(BVHNode));
+	if ( !permutation.empty() ) f.write((const char*) &permutation[0],permutation.size() * sizeof(unsigned int));
+	if ( !f.good() ) return false;}
+	remove(filename.c_str());
+	return rename(temp.c_str(),filename.c_str()) == 0;
+}
+
+BVH* BVH::Load(const std::string& filename, const std::vector<Triangle*>& tris, boost::uint64_t hash) {
+	{std::ifstream f(filename.c_str(),std::ios::binary);
+	if ( !f.good() ) return 0;}
+
+	boost::interprocess::mapped_region* region;
+	try {
+		boost::interprocess::file_mapping file(filename.c_str(),boost::interprocess::read_only);
+		region = new boost::interprocess::mapped_region(file,boost::interprocess::read_only);
+	} catch ( boost::interprocess::interprocess_exception& ) {
+		return 0;
+	}
+
+	const char* data = (const char*) region->get_address();
+	const size_t size = region->get_size();
+	const CacheHeader* header = (const CacheHeader*) data;
+	if ( size < sizeof(CacheHeader) ||
+		memcmp(header->magic,CACHE_MAGIC,sizeof(CACHE_MAGIC)) != 0 ||
+		header->version != CACHE_VERSION ||
+		header->node_size != sizeof(BVHNode) ||
+		header->hash != hash ||
+		header->triangle_count != tris.size() ||
+		size != sizeof(CacheHeader) + header->node_count * sizeof(BVHNode) + header->triangle_count * sizeof(unsigned int) ) {
+		delete region;
+		return 0;
+	}
+
+	// A stale or damaged file of the right size is rebuilt as well
+	int depth;
+	if ( !ValidNodes((const BVHNode*) (data + sizeof(CacheHeader)),header->node_count,header->triangle_count,depth) ||
+		depth != header->depth ) {
+		delete region;
+		return 0;
+	}
+
+	BVH* bvh = new BVH();
+	bvh->region = region;
+	bvh->node_data = (const BVHNode*) (data + sizeof(CacheHeader));
+	bvh->node_count = header->node_count;
+	bvh->depth = header->depth;
+	bvh->leaf_count = header->leaf_count;
+	const unsigned int* perm = (const unsigned int*) (data + sizeof(CacheHeader) + header->node_count * sizeof(BVHNode));
+	bvh->triangles.reserve(tris.size());
+	for ( unsigned int i = 0; i < header->triangle_count; ++ i ) {
+		if ( perm[i] >= tris.size() ) {
+			delete bvh;
+			return 0;
+		}
+		bvh->triangles.push_back(tris[perm[i]]);
+	}
+	bvh->permutation.assign(perm,perm+header->triangle_count);
+	return bvh;
+}
+
+void BVH::Build(std::vector<BuildItem>& items, unsigned int node, unsigned int begin, unsigned int end, int level) {
+	if ( level > depth ) depth = level;
+
+	Bounds bounds, centroids;
+	for ( unsigned int i = begin; i < end; ++ i ) {
+		bounds.Extend(items[i].min,items[i].max);
+		centroids.Extend(items[i].centroid,items[i].centroid);
+	}
+	BVHNode& n = nodes[node];
+	for ( int i = 0; i < 3; ++ i ) {
+		n.min[i] = bounds.min[i];
+		n.max[i] = bounds.max[i];
+	}
+	n.axis = 0;
+
+	const unsigned int count = end - begin;
+	unsigned int mid = begin;
+
+	if ( count > MIN_LEAF_SIZE ) {
+		// Evaluate the Surface Area Heuristic at the bin boundaries along
+		// all three axes and pick the split with the lowest cost.
+		float best_cost = 1e30f;
+		int best_axis = -1;
+		float best_split = 0.0f;
+		const float area = bounds.Area();
+		for ( int axis = 0; axis < 3 && level < MAX_SAH_DEPTH; ++ axis ) {
+			const float cmin = centroids.min[axis];
+			const float extent = centroids.max[axis] - cmin;
+			if ( extent <= 0.0f ) continue;
+			const float scale = SAH_BINS / extent;
+			Bounds bin_bounds[SAH_BINS];
+			unsigned int bin_count[SAH_BINS] = {0};
+			for ( unsigned int i = begin; i < end; ++ i ) {
+				int b = (int) ((items[i].centroid[axis] - cmin) * scale);
+				if ( b >= SAH_BINS ) b = SAH_BINS - 1;
+				bin_count[b] ++;
+				bin_bounds[b].Extend(items[i].min,items[i].max);
+			}
+			float right_area[SAH_BINS];
+			unsigned int right_count[SAH_BINS];
+			Bounds acc;
+			unsigned int acc_count = 0;
+			for ( int b = SAH_BINS - 1; b > 0; -- b ) {
+				acc.Extend(bin_bounds[b]);
+				acc_count += bin_count[b];
+				right_area[b] = acc.Area();
+				right_count[b] = acc_count;
+			}
+			acc = Bounds();
+			acc_count = 0;
+			for ( int b = 1; b < SAH_BINS; ++ b ) {
+				acc.Extend(bin_bounds[b-1]);
+				acc_count += bin_count[b-1];
+				if ( !acc_count || !right_count[b] ) continue;
+				const float cost = acc.Area() * acc_count + right_area[b] * right_count[b];
+				if ( cost < best_cost ) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = cmin + b / scale;
+				}
+			}
+		}
+
+		const float split_cost = best_axis < 0 ? 1e30f : SAH_TRAVERSAL_COST + best_cost / area;
+		if ( split_cost < count || count > MAX_LEAF_SIZE ) {
+			if ( best_axis >= 0 ) {
+				n.axis = best_axis;
+				mid = (unsigned int) (std::partition(items.begin()+begin,items.begin()+end,
+					CentroidBelow(best_axis,best_split)) - items.begin());
+			}
+			if ( mid == begin || mid == end ) {
+				// Either the centroids coincide, the maximum depth has been
+				// reached or rounding errors resulted in an empty side. The
+				// node is split at the median of its largest axis instead.
+				int axis = 0;
+				for ( int i = 1; i < 3; ++ i ) {
+					if ( bounds.max[i] - bounds.min[i] > bounds.max[axis] - bounds.min[axis] ) axis = i;
+				}
+				n.axis = axis;
+				mid = begin + count / 2;
+				std::nth_element(items.begin()+begin,items.begin()+mid,items.begin()+end,CentroidLess(axis));
+			}
+		}
+	}
+
+	if ( mid == begin ) {
+		n.offset = (unsigned int) triangles.size();
+		n.count = (unsigned short) count;
+		for ( unsigned int i = begin; i < end; ++ i ) {
+			triangles.push_back(items[i].triangle);
+			permutation.push_back(items[i].index);
+		}
+		leaf_count ++;
+		return;
+	}
+
+	n.count = 0;
+	const unsigned int first = (unsigned int) nodes.size();
+	nodes.push_back(BVHNode());
+	Build(items,first,begin,mid,level+1);
+	const unsigned int second = (unsigned int) nodes.size();
+	nodes.push_back(BVHNode());
+	nodes[node].offset = second;
+	Build(items,second,mid,end,level+1);
+}
+
+const std::vector<Triangle*>& BVH::getTriangles() const {
+	return triangles;
+}
+
+bool BVH::RayIntersection(const TriangleStore& store, const gmtl::Rayf& r, float& t, unsigned int& index) const {
+	if ( !node_count ) return false;
+
+	float o[3], inv[3];
+	bool negative[3];
+	PrepareRay(r,o,inv,negative);
+
+	unsigned int stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	bool hit = false;
+
+	while ( stack_size ) {
+		const unsigned int node_index = stack[--stack_size];
+		const BVHNode& node = node_data[node_index];
+		if ( !IntersectBox(node,o,inv,t) ) continue;
+		if ( node.count ) {
+			if ( store.RayIntersection(r,node.offset,node.offset+node.count,t,index) ) {
+				hit = true;
+			}
+		} else {
+			// Visit the child closest to the ray origin first, so that
+			// the far child can be culled by the hit found in the near one.
+			if ( negative[node.axis] ) {
+				stack[stack_size++] = node_index + 1;
+				stack[stack_size++] = node.offset;
+			} else {
+				stack[stack_size++] = node.offset;
+				stack[stack_size++] = node_index + 1;
+			}
+		}
+	}
+	return hit;
+}
+
+bool BVH::Occluded(const TriangleStore& store, const gmtl::Point3f& a, const gmtl::Point3f& b) const {
+	if ( !node_count ) return false;
+
+	// The segment is expressed as a ray with an unnormalized direction, so
+	// that the parametric range of the segment is (0,1).
+	const gmtl::Vec3f dir = b - a;
+	const gmtl::Rayf r(a,dir);
+	float o[3], inv[3];
+	bool negative[3];
+	PrepareRay(r,o,inv,negative);
+
+	unsigned int stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while ( stack_size ) {
+		const unsigned int index = stack[--stack_size];
+		const BVHNode& node = node_data[index];
+		if ( !IntersectBox(node,o,inv,1.0f) ) continue;
+		if ( node.count ) {
+			if ( store.LineIntersection(r,node.offset,node.offset+node.count) ) {
+				return true;
+			}
+		} else if ( negative[node.axis] ) {
+			stack[stack_size++] = index + 1;
+			stack[stack_size++] = node.offset;
+		} else {
+			stack[stack_size++] = node.offset;
+			stack[stack_size++] = index + 1;
+		}
+	}
+	return false;
+}
+
+void BVH::RayIntersection(const TriangleStore& store, int n, const gmtl::Rayf* r, float* t, unsigned int* index, bool* hit) const {
+	for ( int j = 0; j < n; ++ j ) hit[j] = false;
+	if ( !node_count ) return;
+
+	Packet packet;
+	for ( int j = 0; j < n; ++ j ) {
+		packet.Set(j,r[j],t[j]);
+	}
+	PacketItem stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = PacketItem(0,(1 << n) - 1);
+
+	while ( stack_size ) {
+		const PacketItem item = stack[--stack_size];
+		const unsigned int node_index = item.node;
+		const BVHNode& node = node_data[node_index];
+		const int mask = IntersectBoxPacket(node,packet,n,item.active);
+		if ( !mask ) continue;
+		if ( node.count ) {
+			// The triangles in the leaf are tested for every ray that hits
+			// its box, the distance to the hit point found is written to the
+			// packet directly, so that it is used to cull subsequent nodes.
+			for ( int j = 0; j < n; ++ j ) {
+				if ( (mask & (1 << j)) && store.RayIntersection(r[j],node.offset,node.offset+node.count,packet.t[j],index[j]) ) {
+					hit[j] = true;
+				}
+			}
+		} else {
+			// The order of the children is determined by the first ray that
+			// hits the box, for coherent rays this is a good indication for
+			// the remaining rays in the packet as well.
+			if ( packet.negative[node.axis][FirstBit(mask)] ) {
+				stack[stack_size++] = PacketItem(node_index + 1,mask);
+				stack[stack_size++] = PacketItem(node.offset,mask);
+			} else {
+				stack[stack_size++] = PacketItem(node.offset,mask);
+				stack[stack_size++] = PacketItem(node_index + 1,mask);
+			}
+		}
+	}
+	for ( int j = 0; j < n; ++ j ) {
+		t[j] = packet.t[j];
+	}
+}
+
+void BVH::Occluded(const TriangleStore& store, int n, const gmtl::Point3f* a, const gmtl::Point3f& b, bool* occluded) const {
+	gmtl::Rayf r[MAX_PACKET_SIZE];
+	for ( int j = 0; j < n; ++ j ) {
+		const gmtl::Vec3f dir = b - a[j];
+		r[j] = gmtl::Rayf(a[j],dir);
+	}
+	Occluded(store,n,r,occluded);
+}
+
+void BVH::Occluded(const TriangleStore& store, int n, const gmtl::Point3f& a, const gmtl::Point3f* b, bool* occluded) const {
+	gmtl::Rayf r[MAX_PACKET_SIZE];
+	for ( int j = 0; j < n; ++ j ) {
+		const gmtl::Vec3f dir = b[j] - a;
+		r[j] = gmtl::Rayf(a,dir);
+	}
+	Occluded(store,n,r,occluded);
+}
+
+void BVH::Occluded(const TriangleStore& store, int n, const gmtl::Rayf* r, bool* occluded) const {
+	for ( int j = 0; j < n; ++ j ) occluded[j] = false;
+	if ( !node_count ) return;
+
+	Packet packet;
+	for ( int j = 0; j < n; ++ j ) {
+		packet.Set(j,r[j],1.0f);
+	}
+	// Segments that are found to be blocked no longer take part in the
+	// traversal, they are removed from the active rays of every node that
+	// is visited afterwards.
+	int unblocked = (1 << n) - 1;
+
+	PacketItem stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = PacketItem(0,unblocked);
+
+	while ( stack_size && unblocked ) {
+		const PacketItem item = stack[--stack_size];
+		const unsigned int index = item.node;
+		const BVHNode& node = node_data[index];
+		const int mask = IntersectBoxPacket(node,packet,n,item.active & unblocked);
+		if ( !mask ) continue;
+		if ( node.count ) {
+			for ( int j = 0; j < n; ++ j ) {
+				if ( (mask & (1 << j)) && store.LineIntersection(r[j],node.offset,node.offset+node.count) ) {
+					occluded[j] = true;
+					unblocked &= ~(1 << j);
+				}
+			}
+		} else if ( packet.negative[node.axis][FirstBit(mask)] ) {
+			stack[stack_size++] = PacketItem(index + 1,mask);
+			stack[stack_size++] = PacketItem(node.offset,mask);
+		} else {
+			stack[stack_size++] = PacketItem(node.offset,mask);
+			stack[stack_size++] = PacketItem(index + 1,mask);
+		}
+	}
+}
+
+const BVHNode* BVH::getNodes() const {
+	return node_data;
+}
+
+unsigned int BVH::NodeCount() const {
+	return node_count;
+}
+
+std::string BVH::toString() const {
+	std::stringstream ss;
+	ss << std::setprecision(std::cout.precision()) << std::fixed;
+	ss << "Hierarchy" << std::endl;
+	ss << " +- nodes: " << node_count << std::endl;
+	ss << " +- leaves: " << leaf_count << std::endl;
+	ss << " +- depth: " << depth << std::endl;
+	ss << " +- triangles per leaf: " << (leaf_count ? (float)triangles.size() / leaf_count : 0.0f) << std::endl;
+	return ss.str();
+}
@@ -0,0 +1,129 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include <gmtl/Ray.h>
+
+#include "Triangle.h"
+#include "TriangleStore.h"
+
+// The maximum number of rays in a packet traced by the packet variants of
+// BVH::RayIntersection() and BVH::Occluded()
+#define MAX_PACKET_SIZE 16
+
+namespace boost { namespace interprocess { class mapped_region; } }
+
+/// A single node of the bounding volume hierarchy. Nodes are stored in a
+/// flat array in depth-first order, so the first child of an interior node
+/// immediately follows its parent. The node is 32 bytes, so that two nodes
+/// share a single cache line.
+struct BVHNode {
+	float min[3];
+	/// For leaf nodes the index of the first triangle, for interior nodes
+	/// the index of the second child.
+	unsigned int offset;
+	float max[3];
+	/// The number of triangles in a leaf node, zero for interior nodes.
+	unsigned short count;
+	/// The axis along which the children of an interior node are split.
+	unsigned short axis;
+};
+
+/// A bounding volume hierarchy over the triangles of a mesh, built using
+/// the Surface Area Heuristic. The hierarchy is built once after all meshes
+/// have been combined and is used to limit the ray-triangle intersection
+/// tests to the triangles in the vicinity of the ray. The leaves of the
+/// hierarchy refer to consecutive ranges of triangles in a TriangleStore
+/// that is created in the order returned by getTriangles().
+class BVH {
+private:
+	std::vector<BVHNode> nodes;
+	std::vector<Triangle*> triangles;
+	std::vector<unsigned int> permutation;
+	/// The nodes used for traversal, these either point into the nodes vector
+	/// or, for a hierarchy loaded from a cache file, into the mapped file.
+	const BVHNode* node_data;
+	unsigned int node_count;
+	boost::interprocess::mapped_region* region;
+	int depth;
+	int leaf_count;
+	struct BuildItem;
+	void Build(std::vector<BuildItem>& items, unsigned int node, unsigned int begin, unsigned int end, int level);
+	/// Tests the packet of n line segments, expressed as rays with an
+	/// unnormalized direction, for occlusion.
+	void Occluded(const TriangleStore& store, int n, const gmtl::Rayf* r, bool* occluded) const;
+	BVH();
+public:
+	/// Builds the hierarchy over the triangles.
+	BVH(const std::vector<Triangle*>& tris);
+	~BVH();
+	/// Returns a hash of the vertices of the triangles, which identifies the
+	/// geometry a hierarchy is built for, regardless of the materials.
+	static boost::uint64_t Hash(const std::vector<Triangle*>& tris);
+	/// Writes the hierarchy to a cache file, that can be mapped into memory
+	/// by Load() in subsequent runs. Returns whether the file was written.
+	bool Save(const std::string& filename, boost::uint64_t hash) const;
+	/// Maps a hierarchy written by Save() into memory, without building or
+	/// copying the nodes. Returns 0 in case the file does not exist or was
+	/// written for different triangles, a different hash, or by a different
+	/// version of the hierarchy, or in case its nodes do not form a valid
+	/// hierarchy over the triangles, such as for a truncated file.
+	static BVH* Load(const std::string& filename, const std::vector<Triangle*>& tris, boost::uint64_t hash);
+	/// Returns the triangles in the order of the leaf nodes, which is the
+	/// order in which they need to be copied into the triangle store.
+	const std::vector<Triangle*>& getTriangles() const;
+	/// Returns the index in the store of the nearest triangle hit by the
+	/// ray for which the parametric distance t lies within (0.001, t). On
+	/// entry t defines the maximum distance of the hit point.
+	bool RayIntersection(const TriangleStore& store, const gmtl::Rayf& r, float& t, unsigned int& index) const;
+	/// Returns whether any triangle intersects the line segment between a
+	/// and b. Traversal is terminated as soon as a blocking triangle is
+	/// found, as opposed to looking for the nearest hit.
+	bool Occluded(const TriangleStore& store, const gmtl::Point3f& a, const gmtl::Point3f& b) const;
+	/// Traces a packet of n rays, at most MAX_PACKET_SIZE, through the
+	/// hierarchy at once. A node is fetched once for the entire packet and
+	/// its bounding box is tested against multiple rays per instruction.
+	/// For every ray the result is the same as for RayIntersection(), the
+	/// arrays t, index and hit are indexed like the rays. This is most
+	/// effective for coherent rays, such as those that share an origin.
+	void RayIntersection(const TriangleStore& store, int n, const gmtl::Rayf* r, float* t, unsigned int* index, bool* hit) const;
+	/// Tests a packet of n line segments, at most MAX_PACKET_SIZE, that
+	/// all end in point b for occlusion at once. For every segment the
+	/// result is the same as for Occluded().
+	void Occluded(const TriangleStore& store, int n, const gmtl::Point3f* a, const gmtl::Point3f& b, bool* occluded) const;
+	/// Tests a packet of n line segments that all start in point a for
+	/// occlusion at once, such as those from a vertex of a path to multiple
+	/// listeners.
+	void Occluded(const TriangleStore& store, int n, const gmtl::Point3f& a, const gmtl::Point3f* b, bool* occluded) const;
+	/// Returns the nodes of the hierarchy in depth-first order.
+	const BVHNode* getNodes() const;
+	/// Returns the number of nodes in the hierarchy.
+	unsigned int NodeCount() const;
+	/// Returns a textual summary of the hierarchy.
+	std::string toString() const;
+};
+
+#endif
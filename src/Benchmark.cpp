@@ -0,0 +1,769 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <gmtl/gmtl.h>
+#include <gmtl/Intersection.h>
+
+#include "Triangle.h"
+#include "TriangleStore.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "Distributions.h"
+#include "Random.h"
+#include "Sampler.h"
+#include "Recorder.h"
+#include "MonoRecorder.h"
+#include "SoundFile.h"
+#include "FFT.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "Scene.h"
+#include "HelperFunctions.h"
+#include "Benchmark.h"
+
+namespace {
+	double Now() {
+		static const boost::posix_time::ptime epoch = boost::posix_time::microsec_clock::universal_time();
+		return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds() / 1e6;
+	}
+
+	gmtl::Vec3f RandomVec(float size) {
+		return gmtl::Vec3f(gmtl::Math::rangeRandom(-size,size),
+			gmtl::Math::rangeRandom(-size,size),
+			gmtl::Math::rangeRandom(-size,size));
+	}
+
+	struct CellLess {
+		bool operator()(const std::pair<unsigned int,gmtl::Vec3f>& a, const std::pair<unsigned int,gmtl::Vec3f>& b) const {
+			return a.first < b.first;
+		}
+	};
+
+	void PrintTiming(const std::string& name, double secs, double count, const char* unit, double reference = -1.0) {
+		std::cout << " +- " << name << ": " << secs * 1e9 / count << " ns/" << unit;
+		if ( reference > 0.0 ) std::cout << " (" << reference / secs << "x)";
+		std::cout << std::endl;
+	}
+
+	// Compares the nearest hit and line segment tests of the gmtl triangles
+	// with those of the triangle store. Both scan all triangles linearly, so
+	// this isolates the effect of the memory layout and precomputed edges.
+	int BenchmarkIntersection() {
+		const int num_triangles = 1024;
+		const int num_rays = 20000;
+		gmtl::Math::seedRandom(1);
+
+		std::vector<Triangle*> tris;
+		for ( int i = 0; i < num_triangles; ++ i ) {
+			const gmtl::Point3f a = gmtl::Point3f(RandomVec(10.0f));
+			const gmtl::Point3f b = a + RandomVec(1.0f);
+			const gmtl::Point3f c = a + RandomVec(1.0f);
+			Triangle* t = new Triangle(a,b,c);
+			t->m = 0;
+			tris.push_back(t);
+		}
+		std::vector<gmtl::Rayf> rays, segments;
+		for ( int i = 0; i < num_rays; ++ i ) {
+			const gmtl::Point3f o = gmtl::Point3f(RandomVec(10.0f));
+			rays.push_back(gmtl::Rayf(o,gmtl::makeNormal(RandomVec(1.0f))));
+			segments.push_back(gmtl::Rayf(o,RandomVec(10.0f)));
+		}
+		TriangleStore store(tris);
+		const double tests = (double) num_triangles * num_rays;
+		int mismatches = 0;
+		float u,v,t;
+
+		std::vector<int> nearest(num_rays,-1);
+		std::vector<float> nearest_t(num_rays);
+		double start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			float d = 1000000;
+			for ( int j = 0; j < num_triangles; ++ j ) {
+				if ( gmtl::intersectDoubleSided(*tris[j],rays[i],u,v,t) && t > 0.001f && t < d ) {
+					d = t;
+					nearest[i] = j;
+				}
+			}
+			nearest_t[i] = d;
+		}
+		const double nearest_gmtl = Now() - start;
+
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			float d = 1000000;
+			unsigned int index;
+			const int hit = store.RayIntersectionScalar(rays[i],0,store.size(),d,index) ? (int) index : -1;
+			if ( hit != nearest[i] || d != nearest_t[i] ) mismatches ++;
+		}
+		const double nearest_scalar = Now() - start;
+
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			float d = 1000000;
+			unsigned int index;
+			const int hit = store.RayIntersection(rays[i],0,store.size(),d,index) ? (int) index : -1;
+			if ( hit != nearest[i] || d != nearest_t[i] ) mismatches ++;
+		}
+		const double nearest_store = Now() - start;
+
+		std::vector<bool> blocked(num_rays);
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			bool b = false;
+			for ( int j = 0; j < num_triangles && !b; ++ j ) {
+				b = gmtl::intersectDoubleSided(*tris[j],segments[i],u,v,t) && t > 1e-5f && t < 1.0f;
+			}
+			blocked[i] = b;
+		}
+		const double segment_gmtl = Now() - start;
+
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			if ( store.LineIntersectionScalar(segments[i],0,store.size()) != blocked[i] ) mismatches ++;
+		}
+		const double segment_scalar = Now() - start;
+
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			if ( store.LineIntersection(segments[i],0,store.size()) != blocked[i] ) mismatches ++;
+		}
+		const double segment_store = Now() - start;
+
+		// Short ranges that do not start at a multiple of the number of
+		// lanes, as encountered in the leaves of the hierarchy.
+		for ( int i = 0; i < num_rays; ++ i ) {
+			const unsigned int begin = i % 61, end = begin + 1 + i % 13;
+			float d1 = 1000000, d2 = 1000000;
+			unsigned int index1 = 0, index2 = 0;
+			const bool hit1 = store.RayIntersectionScalar(rays[i],begin,end,d1,index1);
+			const bool hit2 = store.RayIntersection(rays[i],begin,end,d2,index2);
+			if ( hit1 != hit2 || index1 != index2 || d1 != d2 ) mismatches ++;
+			if ( store.LineIntersectionScalar(segments[i],begin,end) != store.LineIntersection(segments[i],begin,end) ) mismatches ++;
+		}
+
+		std::cout << "Intersection benchmark" << std::endl;
+		std::cout << " +- triangles: " << num_triangles << std::endl;
+		std::cout << " +- rays: " << num_rays << std::endl;
+		std::cout << " +- instruction set: " << TriangleStore::getInstructionSet() << std::endl;
+		PrintTiming("nearest hit, gmtl",nearest_gmtl,tests,"test");
+		PrintTiming("nearest hit, store scalar",nearest_scalar,tests,"test",nearest_gmtl);
+		PrintTiming("nearest hit, store",nearest_store,tests,"test",nearest_gmtl);
+		// Line segment tests terminate at the first hit, hence the number
+		// of tests is only an upper bound, the ratio is still meaningful.
+		PrintTiming("line segment, gmtl",segment_gmtl,tests,"test");
+		PrintTiming("line segment, store scalar",segment_scalar,tests,"test",segment_gmtl);
+		PrintTiming("line segment, store",segment_store,tests,"test",segment_gmtl);
+		std::cout << " +- mismatches: " << mismatches << std::endl;
+
+		for ( std::vector<Triangle*>::const_iterator it = tris.begin(); it != tris.end(); ++ it ) {
+			delete *it;
+		}
+		return mismatches ? 1 : 0;
+	}
+
+	// Compares tracing rays one by one through the hierarchy with tracing
+	// them in packets. The rays are made coherent like in the renderer: the
+	// rays share their origin and are sorted by direction in batches, the
+	// line segments connect the hit points of these rays to a listener.
+	int BenchmarkPackets() {
+		const int num_triangles = 16384;
+		const int num_rays = 65536;
+		const int batch_size = 1024;
+		gmtl::Math::seedRandom(1);
+		RandomGenerator rng(1);
+
+		std::vector<Triangle*> tris;
+		for ( int i = 0; i < num_triangles; ++ i ) {
+			const gmtl::Point3f a = gmtl::Point3f(RandomVec(10.0f));
+			const gmtl::Point3f b = a + RandomVec(0.5f);
+			const gmtl::Point3f c = a + RandomVec(0.5f);
+			Triangle* t = new Triangle(a,b,c);
+			t->m = 0;
+			tris.push_back(t);
+		}
+		const BVH bvh(tris);
+		const TriangleStore store(bvh.getTriangles());
+
+		const gmtl::Point3f source(1.0f,2.0f,3.0f);
+		const gmtl::Point3f listener(-3.0f,-2.0f,1.0f);
+		std::vector<gmtl::Rayf> rays;
+		for ( int i = 0; i < num_rays; i += batch_size ) {
+			std::vector< std::pair<unsigned int,gmtl::Vec3f> > batch;
+			for ( int j = 0; j < batch_size; ++ j ) {
+				gmtl::Vec3f v;
+				const float u1 = rng.Uniform();
+				const float u2 = rng.Uniform();
+				Sample_Sphere(v,u1,u2);
+				batch.push_back(std::make_pair(Direction_Cell(v,4),v));
+			}
+			std::sort(batch.begin(),batch.end(),CellLess());
+			for ( int j = 0; j < batch_size; ++ j ) {
+				rays.push_back(gmtl::Rayf(source,batch[j].second));
+			}
+		}
+
+		std::vector<float> single_t(num_rays,1000000);
+		std::vector<unsigned int> single_index(num_rays);
+		std::vector<bool> single_hit(num_rays);
+		double start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			single_hit[i] = bvh.RayIntersection(store,rays[i],single_t[i],single_index[i]);
+		}
+		const double single_nearest = Now() - start;
+
+		std::vector<gmtl::Point3f> points;
+		for ( int i = 0; i < num_rays; ++ i ) {
+			points.push_back(single_hit[i]
+				? gmtl::Point3f(rays[i].mOrigin + rays[i].mDir * single_t[i])
+				: gmtl::Point3f(rays[i].mOrigin + rays[i].mDir * 10.0f));
+		}
+
+		std::vector<bool> single_occluded(num_rays);
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			single_occluded[i] = bvh.Occluded(store,points[i],listener);
+		}
+		const double single_segment = Now() - start;
+
+		std::cout << "Packet benchmark" << std::endl;
+		std::cout << " +- triangles: " << num_triangles << std::endl;
+		std::cout << " +- rays: " << num_rays << std::endl;
+		PrintTiming("nearest hit, single rays",single_nearest,num_rays,"ray");
+		PrintTiming("line segment, single rays",single_segment,num_rays,"ray");
+
+		int mismatches = 0;
+		for ( int packet_size = 4; packet_size <= MAX_PACKET_SIZE; packet_size *= 2 ) {
+			std::vector<float> t(num_rays,1000000);
+			std::vector<unsigned int> index(num_rays);
+			bool hit[MAX_PACKET_SIZE];
+			start = Now();
+			for ( int i = 0; i < num_rays; i += packet_size ) {
+				bvh.RayIntersection(store,packet_size,&rays[i],&t[i],&index[i],hit);
+				for ( int j = 0; j < packet_size; ++ j ) {
+					if ( hit[j] != single_hit[i+j] || (hit[j] && t[i+j] != single_t[i+j]) ) mismatches ++;
+				}
+			}
+			const double packet_nearest = Now() - start;
+
+			start = Now();
+			for ( int i = 0; i < num_rays; i += packet_size ) {
+				bvh.Occluded(store,packet_size,&points[i],listener,hit);
+				for ( int j = 0; j < packet_size; ++ j ) {
+					if ( hit[j] != single_occluded[i+j] ) mismatches ++;
+				}
+			}
+			const double packet_segment = Now() - start;
+
+			std::stringstream ss;
+			ss << packet_size;
+			PrintTiming("nearest hit, packets of " + ss.str(),packet_nearest,num_rays,"ray",single_nearest);
+			PrintTiming("line segment, packets of " + ss.str(),packet_segment,num_rays,"ray",single_segment);
+		}
+		std::cout << " +- mismatches: " << mismatches << std::endl;
+
+		for ( std::vector<Triangle*>::const_iterator it = tris.begin(); it != tris.end(); ++ it ) {
+			delete *it;
+		}
+		return mismatches ? 1 : 0;
+	}
+
+	// Compares the full precision binary hierarchy and triangle store with
+	// the compact wide hierarchy and the triangle store without normals.
+	int BenchmarkCompact() {
+		const int num_triangles = 262144;
+		const int num_rays = 65536;
+		gmtl::Math::seedRandom(1);
+
+		std::vector<Triangle*> tris;
+		for ( int i = 0; i < num_triangles; ++ i ) {
+			const gmtl::Point3f a = gmtl::Point3f(RandomVec(10.0f));
+			const gmtl::Point3f b = a + RandomVec(0.2f);
+			const gmtl::Point3f c = a + RandomVec(0.2f);
+			Triangle* t = new Triangle(a,b,c);
+			t->m = 0;
+			tris.push_back(t);
+		}
+		std::vector<gmtl::Rayf> rays;
+		std::vector<gmtl::Point3f> points;
+		for ( int i = 0; i < num_rays; ++ i ) {
+			const gmtl::Point3f o = gmtl::Point3f(RandomVec(10.0f));
+			rays.push_back(gmtl::Rayf(o,gmtl::makeNormal(RandomVec(1.0f))));
+			points.push_back(gmtl::Point3f(RandomVec(10.0f)));
+		}
+		const gmtl::Point3f listener(-3.0f,-2.0f,1.0f);
+
+		const BVH* bvh = new BVH(tris);
+		const TriangleStore store(bvh->getTriangles());
+		const WideBVH wide(*bvh);
+		const TriangleStore compact_store(wide.getTriangles(),false);
+		const double full_bytes = (double) bvh->NodeCount() * sizeof(BVHNode) + store.byteSize();
+		const double compact_bytes = (double) wide.NodeCount() * sizeof(WideBVHNode) + compact_store.byteSize();
+
+		std::vector<float> full_t(num_rays,1000000);
+		std::vector<unsigned int> full_index(num_rays);
+		std::vector<bool> full_hit(num_rays);
+		double start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			full_hit[i] = bvh->RayIntersection(store,rays[i],full_t[i],full_index[i]);
+		}
+		const double full_nearest = Now() - start;
+
+		std::vector<bool> full_occluded(num_rays);
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			full_occluded[i] = bvh->Occluded(store,points[i],listener);
+		}
+		const double full_segment = Now() - start;
+
+		int mismatches = 0;
+		std::vector<float> compact_t(num_rays,1000000);
+		std::vector<unsigned int> compact_index(num_rays);
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			const bool hit = wide.RayIntersection(compact_store,rays[i],compact_t[i],compact_index[i]);
+			if ( hit != full_hit[i] || (hit && compact_t[i] != full_t[i]) ) mismatches ++;
+		}
+		const double compact_nearest = Now() - start;
+
+		start = Now();
+		for ( int i = 0; i < num_rays; ++ i ) {
+			if ( wide.Occluded(compact_store,points[i],listener) != full_occluded[i] ) mismatches ++;
+		}
+		const double compact_segment = Now() - start;
+
+		// The normals derived from the edges equal the stored normals
+		for ( int i = 0; i < num_rays; ++ i ) {
+			if ( !full_hit[i] ) continue;
+			const Triangle* a = bvh->getTriangles()[full_index[i]];
+			const Triangle* b = wide.getTriangles()[compact_index[i]];
+			if ( a != b ) continue;
+			const gmtl::Vec3f na = store.getNormal(full_index[i]);
+			const gmtl::Vec3f nb = compact_store.getNormal(compact_index[i]);
+			if ( na[0] != nb[0] || na[1] != nb[1] || na[2] != nb[2] ) mismatches ++;
+		}
+
+		std::cout << "Compact hierarchy benchmark" << std::endl;
+		std::cout << " +- triangles: " << num_triangles << std::endl;
+		std::cout << " +- rays: " << num_rays << std::endl;
+		std::cout << " +- memory per triangle, full precision: " << full_bytes / num_triangles << " bytes" << std::endl;
+		std::cout << " +- memory per triangle, compact: " << compact_bytes / num_triangles << " bytes" << std::endl;
+		PrintTiming("nearest hit, full precision",full_nearest,num_rays,"ray");
+		PrintTiming("nearest hit, compact",compact_nearest,num_rays,"ray",full_nearest);
+		PrintTiming("line segment, full precision",full_segment,num_rays,"ray");
+		PrintTiming("line segment, compact",compact_segment,num_rays,"ray",full_segment);
+		std::cout << " +- mismatches: " << mismatches << std::endl;
+
+		delete bvh;
+		for ( std::vector<Triangle*>::const_iterator it = tris.begin(); it != tris.end(); ++ it ) {
+			delete *it;
+		}
+		return mismatches ? 1 : 0;
+	}
+
+	// Renders the energy that reaches a listener in a box shaped room by
+	// paths of at most three diffuse reflections, binned by the length of
+	// the path. This resembles the impulse response of Scene::Trace().
+	void Echogram(const BVH& bvh, const TriangleStore& store, Sampler& sampler, int num_samples, std::vector<double>& bins) {
+		const gmtl::Point3f source(2.0f,2.0f,2.0f);
+		const gmtl::Point3f listener(7.0f,4.0f,1.5f);
+		const float bin_width = 2.0f;
+		bins.assign(bins.size(),0.0);
+		for ( int i = 0; i < num_samples; ++ i ) {
+			sampler.StartPath(i);
+			float u1, u2;
+			sampler.Get2D(u1,u2);
+			gmtl::Vec3f d;
+			Sample_Sphere(d,u1,u2);
+			gmtl::Rayf ray(source,d);
+			float length = 0.0f;
+			for ( int bounce = 0; bounce < 3; ++ bounce ) {
+				float t = 1000000;
+				unsigned int index;
+				if ( !bvh.RayIntersection(store,ray,t,index) ) break;
+				const gmtl::Point3f p = ray.mOrigin + ray.mDir * t;
+				gmtl::Vec3f n = store.getNormal(index);
+				if ( gmtl::dot(n,ray.mDir) > 0.0f ) n *= -1.0f;
+				length += t;
+				const gmtl::Vec3f lsdir = listener - p;
+				const float l = gmtl::length(lsdir);
+				const float cos_theta = gmtl::dot(n,lsdir) / l;
+				const unsigned int bin = (unsigned int) ((length + l) / bin_width);
+				if ( cos_theta > 0.0f && bin < bins.size() ) {
+					bins[bin] += cos_theta / (l * l) / num_samples;
+				}
+				sampler.Get2D(u1,u2);
+				Sample_Hemi(d,n,u1,u2);
+				ray = gmtl::Rayf(p,d);
+			}
+		}
+	}
+
+	// Adds the triangles of a box shaped room from the origin to size, of
+	// material m, to tris.
+	void BoxTriangles(const float* size, Material* m, std::vector<Triangle*>& tris) {
+		for ( int axis = 0; axis < 3; ++ axis ) {
+			for ( int side = 0; side < 2; ++ side ) {
+				// The corners of the face of the box orthogonal to axis
+				gmtl::Point3f c[4];
+				for ( int j = 0; j < 4; ++ j ) {
+					c[j][axis] = side ? size[axis] : 0.0f;
+					c[j][(axis+1)%3] = (j == 1 || j == 2) ? size[(axis+1)%3] : 0.0f;
+					c[j][(axis+2)%3] = (j >= 2) ? size[(axis+2)%3] : 0.0f;
+				}
+				tris.push_back(new Triangle(c[0],c[1],c[2]));
+				tris.push_back(new Triangle(c[0],c[2],c[3]));
+			}
+		}
+		for ( std::vector<Triangle*>::const_iterator it = tris.begin(); it != tris.end(); ++ it ) {
+			(*it)->m = m;
+		}
+	}
+
+	double RelativeError(const std::vector<double>& a, const std::vector<double>& reference) {
+		double error = 0.0, norm = 0.0;
+		for ( unsigned int i = 0; i < a.size(); ++ i ) {
+			error += (a[i] - reference[i]) * (a[i] - reference[i]);
+			norm += reference[i] * reference[i];
+		}
+		return sqrt(error / norm);
+	}
+
+	// Compares the error of the echogram above rendered with pseudo random
+	// and quasi random numbers, with respect to a reference rendered with
+	// many samples, for increasing numbers of samples.
+	int BenchmarkConvergence() {
+		const float size[3] = {10.0f,6.0f,4.0f};
+		const int num_seeds = 8;
+		const int reference_samples = 1 << 22;
+		const int num_bins = 32;
+
+		std::vector<Triangle*> tris;
+		BoxTriangles(size,0,tris);
+		const BVH bvh(tris);
+		const TriangleStore store(bvh.getTriangles());
+
+		std::vector<double> reference(num_bins);
+		Sampler reference_sampler(num_seeds,true);
+		Echogram(bvh,store,reference_sampler,reference_samples,reference);
+
+		std::cout << "Convergence benchmark" << std::endl;
+		std::cout << " +- reference samples: " << reference_samples << std::endl;
+		double random_error = 0.0, sobol_error = 0.0;
+		for ( int num_samples = 256; num_samples <= 65536; num_samples *= 4 ) {
+			random_error = sobol_error = 0.0;
+			std::vector<double> bins(num_bins);
+			for ( int seed = 0; seed < num_seeds; ++ seed ) {
+				Sampler random(seed,false);
+				Echogram(bvh,store,random,num_samples,bins);
+				random_error += RelativeError(bins,reference) / num_seeds;
+				Sampler sobol(seed,true);
+				Echogram(bvh,store,sobol,num_samples,bins);
+				sobol_error += RelativeError(bins,reference) / num_seeds;
+			}
+			std::cout << " +- samples: " << std::setw(5) << num_samples
+				<< ", error random: " << std::setprecision(3) << random_error
+				<< ", sobol: " << sobol_error
+				<< " (" << random_error / sobol_error << "x)" << std::endl;
+		}
+
+		for ( std::vector<Triangle*>::const_iterator it = tris.begin(); it != tris.end(); ++ it ) {
+			delete *it;
+		}
+		return sobol_error < random_error ? 0 : 1;
+	}
+
+	// The time domain convolution as it was implemented before the blocked
+	// kernel: a loop over the dry signal, accumulating the scaled response
+	// into the result through the range checked subscript operator.
+	RecorderTrack* ConvolveReference(const RecorderTrack& h, const SoundFile& sound) {
+		RecorderTrack* result = new RecorderTrack();
+		RecorderTrack& _result = *result;
+		const unsigned int len = h.getLength();
+		for ( unsigned int i = 0; i < sound.sample_length; ++ i ) {
+			const float sfs = sound.data[i];
+			int index = i + sound.offset + h.first_sample;
+			for ( unsigned int j = h.first_sample; j < len; ++ j ) {
+				_result[index++] += sfs * h[j];
+			}
+		}
+		return result;
+	}
+
+	// Returns the largest difference between the samples in a and the
+	// reference, relative to the largest sample in the reference.
+	double MaximumDifference(const RecorderTrack& a, const RecorderTrack& reference) {
+		const unsigned int len = (std::max)(a.getLength(),reference.getLength());
+		double difference = 0.0, peak = 0.0;
+		for ( unsigned int i = 0; i < len; ++ i ) {
+			difference = (std::max)(difference,(double) fabs(a[i] - reference[i]));
+			peak = (std::max)(peak,(double) fabs(reference[i]));
+		}
+		return difference / peak;
+	}
+
+	// Compares the time domain convolution of a second of sound with
+	// decaying noise responses of increasing length by the reference loop
+	// above, the blocked kernel of RecorderTrack::ProcessDirect() and the
+	// partitioned frequency domain convolution of RecorderTrack::Process().
+	int BenchmarkConvolution() {
+		const unsigned int sound_length = SAMPLE_RATE;
+		const double tolerance = 1e-5;
+		gmtl::Math::seedRandom(1);
+
+		float* sound_data = new float[sound_length];
+		for ( unsigned int i = 0; i < sound_length; ++ i ) {
+			sound_data[i] = gmtl::Math::rangeRandom(-1.0f,1.0f);
+		}
+		SoundFile sound(sound_data,sound_length,0,true);
+
+		std::cout << "Convolution benchmark" << std::endl;
+		std::cout << " +- samples: " << sound_length << std::endl;
+		int mismatches = 0;
+		for ( unsigned int taps = 16; taps <= 4096; taps *= 4 ) {
+			RecorderTrack h;
+			for ( unsigned int j = 0; j < taps; ++ j ) {
+				h[j] = gmtl::Math::rangeRandom(-1.0f,1.0f) * (1.0f - (float) j / taps);
+			}
+			// The last sample is excluded from the length of the track
+			h[taps] = 0.0f;
+
+			double start = Now();
+			RecorderTrack* reference = ConvolveReference(h,sound);
+			const double reference_time = Now() - start;
+
+			start = Now();
+			RecorderTrack* direct = h.ProcessDirect(&sound);
+			const double direct_time = Now() - start;
+
+			start = Now();
+			RecorderTrack* fft = h.Process(&sound);
+			const double fft_time = Now() - start;
+
+			const double direct_difference = MaximumDifference(*direct,*reference);
+			const double fft_difference = MaximumDifference(*fft,*reference);
+			if ( direct_difference > tolerance || fft_difference > tolerance ) mismatches ++;
+
+			std::stringstream ss;
+			ss << taps << " taps";
+			std::cout << " +- " << ss.str() << ", difference direct: " << std::scientific << direct_difference
+				<< ", fft: " << fft_difference << std::fixed << std::endl;
+			PrintTiming(ss.str() + ", reference",reference_time,sound_length,"sample");
+			PrintTiming(ss.str() + ", direct",direct_time,sound_length,"sample",reference_time);
+			PrintTiming(ss.str() + ", fft",fft_time,sound_length,"sample",reference_time);
+
+			delete reference;
+			delete direct;
+			delete fft;
+		}
+		FFTPlans::Dispose();
+		std::cout << " +- mismatches: " << mismatches << std::endl;
+		return mismatches ? 1 : 0;
+	}
+
+	// Compares adding the contributions of paths to a recorder one by one,
+	// at random offsets in a response of ten seconds, with logging them and
+	// adding them sorted by their arrival time, see Recorder::Flush().
+	int BenchmarkSplat() {
+		const int num_contributions = 1 << 20;
+		const float length = 10.0f;
+		gmtl::Math::seedRandom(1);
+
+		std::vector<float> t(num_contributions), a(num_contributions), dist(num_contributions);
+		for ( int i = 0; i < num_contributions; ++ i ) {
+			t[i] = gmtl::Math::rangeRandom(0.0f,length);
+			a[i] = gmtl::Math::rangeRandom(0.0f,1.0f);
+			dist[i] = t[i] * 343.0f;
+		}
+		const gmtl::Vec3f dir(1.0f,0.0f,0.0f);
+
+		MonoRecorder unsorted(false);
+		double start = Now();
+		for ( int i = 0; i < num_contributions; ++ i ) {
+			unsorted.Record(dir,a[i],t[i],dist[i],0,-1);
+			unsorted.Flush();
+		}
+		const double unsorted_time = Now() - start;
+
+		MonoRecorder sorted(false);
+		start = Now();
+		for ( int i = 0; i < num_contributions; ++ i ) {
+			sorted.Record(dir,a[i],t[i],dist[i],0,-1);
+		}
+		sorted.Flush();
+		const double sorted_time = Now() - start;
+
+		const RecorderTrack& u = *unsorted.tracks[0];
+		const RecorderTrack& s = *sorted.tracks[0];
+		const double difference = MaximumDifference(s,u);
+
+		std::cout << "Splat benchmark" << std::endl;
+		std::cout << " +- contributions: " << num_contributions << std::endl;
+		std::cout << " +- response: " << length << " s" << std::endl;
+		PrintTiming("in order of recording",unsorted_time,num_contributions,"contribution");
+		PrintTiming("sorted by arrival",sorted_time,num_contributions,"contribution",unsorted_time);
+		std::cout << " +- difference: " << std::scientific << difference << std::fixed << std::endl;
+		return difference > 1e-5 ? 1 : 0;
+	}
+
+	// Renders the reflections of an impulse response in chunks, the way
+	// RenderTask does, into a listener that receives no direct sound, as
+	// is the case for a listener that is occluded from the sound source or
+	// for a source that emits from a mesh. The chunks are recorded into
+	// blank copies of the recorder and accumulated, after which the
+	// response is truncated like in Render(). The result is compared with
+	// recording all paths into the recorder at once.
+	int BenchmarkChunks() {
+		const int num_chunks = 64;
+		const int chunk_size = 4096;
+		gmtl::Math::seedRandom(1);
+
+		std::vector<float> t(num_chunks * chunk_size), a(t.size());
+		for ( unsigned int i = 0; i < t.size(); ++ i ) {
+			t[i] = gmtl::Math::rangeRandom(0.01f,1.0f);
+			a[i] = gmtl::Math::rangeRandom(0.0f,1.0f) * (1.0f - t[i]);
+		}
+		const gmtl::Vec3f dir(1.0f,0.0f,0.0f);
+
+		MonoRecorder whole(false);
+		double start = Now();
+		for ( unsigned int i = 0; i < t.size(); ++ i ) {
+			whole.Record(dir,a[i],t[i],t[i]*343.0f,0,-1);
+		}
+		whole.Flush();
+		const double whole_time = Now() - start;
+
+		MonoRecorder context(false);
+		start = Now();
+		for ( int c = 0; c < num_chunks; ++ c ) {
+			Recorder* chunk = context.getBlankCopy(SAMPLE_RATE);
+			for ( int i = c * chunk_size; i < (c + 1) * chunk_size; ++ i ) {
+				chunk->Record(dir,a[i],t[i],t[i]*343.0f,0,-1);
+			}
+			chunk->Flush();
+			context.Accumulate(chunk);
+			delete chunk;
+		}
+		const double chunks_time = Now() - start;
+
+		const double difference = MaximumDifference(*context.tracks[0],*whole.tracks[0]);
+		const unsigned int whole_length = whole.getLength();
+		const float treshold = context.tracks[0]->Maximum() / 256.0f;
+		context.Truncate(context.getLength(treshold));
+		const unsigned int length = context.getLength();
+
+		std::cout << "Chunk benchmark" << std::endl;
+		std::cout << " +- chunks: " << num_chunks << " of " << chunk_size << " paths" << std::endl;
+		PrintTiming("whole response",whole_time,(double) t.size(),"path");
+		PrintTiming("in chunks",chunks_time,(double) t.size(),"path",whole_time);
+		std::cout << " +- difference: " << std::scientific << difference << std::fixed << std::endl;
+		std::cout << " +- length: " << length << " of " << whole_length << " samples after truncation" << std::endl;
+		return difference > 1e-5 || length < SAMPLE_RATE / 2 ? 1 : 0;
+	}
+
+	// Counts the allocations made by Scene::Trace() in a box shaped room
+	// for batches of paths of different sizes, for each of the engines. A
+	// call allocates its buffers regardless of the number of paths, hence
+	// the count needs to be the same for every batch: tracing the rays
+	// themselves should not allocate any memory.
+	int BenchmarkAllocations() {
+#ifndef COUNT_ALLOCATIONS
+		std::cout << "Allocations are only counted when compiled with COUNT_ALLOCATIONS" << std::endl;
+		return 1;
+#else
+		const float size[3] = {10.0f,6.0f,4.0f};
+		const int batches[2] = {1024,4096};
+		const char* engines[3] = {"depth-first","packets","wavefront"};
+
+		// All coefficients are set, so that they are looked up without
+		// inserting entries
+		Material* material = new Material(false);
+		material->name = "box";
+		for ( int band = 0; band < 3; ++ band ) {
+			material->reflection_coefficient[band] = 0.9f;
+			material->absorption_coefficient[band] = 0.9f;
+			material->specularity_coefficient[band] = 0.2f;
+		}
+		Mesh* mesh = Mesh::Empty();
+		BoxTriangles(size,material,mesh->tris);
+		mesh->material = material;
+		mesh->BoundingBox();
+
+		Scene* scene = new Scene();
+		scene->max_ir_length = 1.0f;
+		scene->addMesh(mesh);
+		scene->Prepare();
+		SoundFile* sound = new SoundFile(new float[1],1,0,true);
+		sound->data[0] = 1.0f;
+		sound->setLocation(gmtl::Point3f(2.0f,2.0f,2.0f));
+		scene->addSoundSource(sound);
+		MonoRecorder* listener = new MonoRecorder(false);
+		gmtl::Point3f location(7.0f,4.0f,1.5f);
+		listener->setLocation(location);
+		scene->addListener(listener);
+
+		std::cout << "Allocation benchmark" << std::endl;
+		int mismatches = 0;
+		for ( int e = 0; e < 3; ++ e ) {
+			scene->packet_size = e == 1 ? 8 : 0;
+			scene->wavefront_size = e == 2 ? 256 : 0;
+			long counts[2];
+			// The first batch is traced twice, so that memory that is
+			// allocated once, on first use, is not counted.
+			for ( int i = -1; i < 2; ++ i ) {
+				std::vector<Recorder*> recs(1,listener->getBlankCopy(scene->ResponseLength()));
+				const long before = AllocationCount();
+				scene->Trace(0,0,0.999f,0,batches[(std::max)(i,0)],recs,-1,1);
+				const long allocations = AllocationCount() - before;
+				delete recs[0];
+				if ( i < 0 ) continue;
+				counts[i] = allocations;
+				std::cout << " +- " << engines[e] << ", " << batches[i] << " paths: "
+					<< allocations << " allocations" << std::endl;
+			}
+			if ( counts[0] != counts[1] ) mismatches ++;
+		}
+		std::cout << " +- mismatches: " << mismatches << std::endl;
+
+		delete scene;
+		delete material;
+		return mismatches ? 1 : 0;
+#endif
+	}
+}
+
+int Benchmark(const std::string& name) {
+	if ( name == "intersection" ) return BenchmarkIntersection();
+	if ( name == "packets" ) return BenchmarkPackets();
+	if ( name == "compact" ) return BenchmarkCompact();
+	if ( name == "convergence" ) return BenchmarkConvergence();
+	if ( name == "convolution" ) return BenchmarkConvolution();
+	if ( name == "splat" ) return BenchmarkSplat();
+	if ( name == "chunks" ) return BenchmarkChunks();
+	if ( name == "allocations" ) return BenchmarkAllocations();
+	std::cout << "Unknown benchmark '" << name << "'" << std::endl;
+	return 1;
+}
@@ -0,0 +1,40 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+
+/// Runs one of the microbenchmarks that compare alternative implementations
+/// of the performance critical parts of the renderer on synthetic data:
+///  intersection: the ray-triangle tests of gmtl against the triangle store
+///  packets: tracing single rays against packets of rays through the hierarchy
+///  compact: the full precision hierarchy against the compact wide hierarchy
+///  convergence: the error of pseudo random against quasi random sampling
+///  convolution: the blocked time domain convolution against the plain loop
+///  splat: adding contributions to a recorder in order of recording or arrival
+///  chunks: rendering a response without direct sound at once or in chunks
+///  allocations: the memory allocated by tracing batches of different sizes,
+///   only counted when compiled with COUNT_ALLOCATIONS
+/// Returns a non-zero value in case the benchmark is unknown or in case the
+/// implementations do not give identical results.
+int Benchmark(const std::string& name);
+
+#endif
@@ -0,0 +1,114 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+
+#include "Checkpoint.h"
+
+#define CHECKPOINT_MAGIC "EARC"
+#define CHECKPOINT_VERSION 2
+
+namespace {
+	struct CheckpointHeader {
+		char magic[4];
+		boost::uint32_t version;
+		boost::uint64_t seed;
+		boost::int32_t samples;
+		boost::uint32_t recorder_count;
+	};
+}
+
+std::string Checkpoint::Filename(const std::string& dir, int sound, int band, int keyframe) {
+	std::stringstream ss;
+	ss << dir << "checkpoint.sound-" << sound << ".band-" << band;
+	if ( keyframe >= 0 ) ss << ".keyframe-" << keyframe;
+	ss << ".bin";
+	return ss.str();
+}
+
+bool Checkpoint::Save(const std::string& filename, boost::uint64_t seed, int samples, const std::vector<Recorder*>& recs) {
+	CheckpointHeader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,CHECKPOINT_MAGIC,sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.seed = seed;
+	header.samples = samples;
+	header.recorder_count = (boost::uint32_t) recs.size();
+
+	const std::string temp = filename + ".tmp";
+	{std::ofstream f(temp.c_str(),std::ios::binary);
+	if ( !f.good() ) return false;
+	f.write((const char*) &header,sizeof(header));
+	for ( std::vector<Recorder*>::const_iterator it = recs.begin(); it != recs.end(); ++ it ) {
+		const boost::uint32_t track_count = (boost::uint32_t) (*it)->trackCount();
+		f.write((const char*) &track_count,sizeof(track_count));
+		for ( Recorder::TrackIt tit = (*it)->tracks.begin(); tit != (*it)->tracks.end(); ++ tit ) {
+			(*tit)->Write(f);
+		}
+	}
+	if ( !f.good() ) return false;}
+	remove(filename.c_str());
+	return rename(temp.c_str(),filename.c_str()) == 0;
+}
+
+bool Checkpoint::Load(const std::string& filename, boost::uint64_t& seed, int& samples, const std::vector<Recorder*>& recs) {
+	std::ifstream f(filename.c_str(),std::ios::binary);
+	if ( !f.good() ) return false;
+
+	CheckpointHeader header;
+	if ( !f.read((char*) &header,sizeof(header)) ) return false;
+	if ( memcmp(header.magic,CHECKPOINT_MAGIC,sizeof(header.magic)) ||
+		header.version != CHECKPOINT_VERSION ||
+		header.recorder_count != recs.size() ) return false;
+
+	// The tracks are read into blank copies first, so that the recorders
+	// are only modified in case the whole file could be read.
+	std::vector<Recorder*> copies;
+	bool valid = true;
+	for ( std::vector<Recorder*>::const_iterator it = recs.begin(); valid && it != recs.end(); ++ it ) {
+		boost::uint32_t track_count;
+		Recorder* copy = (*it)->getBlankCopy();
+		copies.push_back(copy);
+		valid = f.read((char*) &track_count,sizeof(track_count)) &&
+			track_count == (boost::uint32_t) copy->trackCount();
+		for ( Recorder::TrackIt tit = copy->tracks.begin(); valid && tit != copy->tracks.end(); ++ tit ) {
+			valid = (*tit)->Read(f);
+		}
+	}
+	if ( valid ) {
+		for ( unsigned int i = 0; i < recs.size(); ++ i ) {
+			std::swap(recs[i]->tracks,copies[i]->tracks);
+			// The recorder has samples in case any of its restored tracks
+			// has a range of samples, see Recorder::getLength().
+			recs[i]->has_samples = false;
+			for ( Recorder::TrackIt tit = recs[i]->tracks.begin(); tit != recs[i]->tracks.end(); ++ tit ) {
+				if ( (*tit)->first_sample <= (*tit)->real_length ) recs[i]->has_samples = true;
+			}
+		}
+		seed = header.seed;
+		samples = header.samples;
+	}
+	for ( std::vector<Recorder*>::const_iterator it = copies.begin(); it != copies.end(); ++ it ) {
+		delete *it;
+	}
+	return valid;
+}
@@ -0,0 +1,49 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "Recorder.h"
+
+/// A checkpoint stores the partial impulse responses of a render, before
+/// they are normalized, together with the number of paths traced and the
+/// seed of the random numbers, so that a render that is resumed from a
+/// checkpoint continues with the paths it would have traced.
+class Checkpoint {
+public:
+	/// Returns the name of the checkpoint file in dir for the impulse
+	/// responses of a sound source, frequency band and keyframe.
+	static std::string Filename(const std::string& dir, int sound, int band, int keyframe);
+	/// Writes the tracks of the recorders in recs to filename. The file is
+	/// written under a temporary name and renamed afterwards, so that a
+	/// checkpoint is never left partially written.
+	static bool Save(const std::string& filename, boost::uint64_t seed, int samples, const std::vector<Recorder*>& recs);
+	/// Restores the tracks of the recorders in recs from filename. Returns
+	/// false in case the file does not exist or does not match recs, in
+	/// which case recs is left untouched.
+	static bool Load(const std::string& filename, boost::uint64_t& seed, int& samples, const std::vector<Recorder*>& recs);
+};
+
+#endif
@@ -0,0 +1,73 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <cmath>
+#include <algorithm>
+
+#include "Convergence.h"
+
+#define MIN_BATCHES 8
+
+Convergence::Convergence(int b, float e, float l) :
+		batch_size(b), target_error(e), bin_length(l), batches(0), error(1.0f) {
+	// Room for one second, the bins grow along with the response
+	Grow((unsigned int) (1.0f / bin_length));
+}
+
+void Convergence::Grow(unsigned int bins) {
+	// The bins grow geometrically, so that they are seldom reallocated
+	bins = (std::max)(bins,(unsigned int) batch.size() * 2);
+	batch.resize(bins,0.0);
+	sum.resize(bins,0.0);
+	sum_squared.resize(bins,0.0);
+}
+
+void Convergence::Merge(const Convergence& other) {
+	if ( other.batch.size() > batch.size() ) Grow((unsigned int) other.batch.size());
+	for ( unsigned int i = 0; i < other.batch.size(); ++ i ) {
+		batch[i] += other.batch[i];
+	}
+}
+
+bool Convergence::EndBatch() {
+	batches ++;
+	double peak = 0.0;
+	for ( unsigned int i = 0; i < batch.size(); ++ i ) {
+		sum[i] += batch[i];
+		sum_squared[i] += batch[i] * batch[i];
+		batch[i] = 0.0;
+		if ( sum[i] > peak ) peak = sum[i];
+	}
+	if ( batches < MIN_BATCHES || peak <= 0.0 ) return false;
+
+	// The relative standard error of the mean energy of every bin
+	const double n = batches;
+	double total = 0.0;
+	int bins = 0;
+	for ( unsigned int i = 0; i < sum.size(); ++ i ) {
+		if ( sum[i] <= peak * 1e-6 ) continue;
+		const double mean = sum[i] / n;
+		const double variance = (std::max)(0.0,(sum_squared[i] / n - mean * mean) * n / (n - 1.0));
+		const double relative = variance / n / (mean * mean);
+		total += relative;
+		bins ++;
+	}
+	error = (float) sqrt(total / bins);
+	return error <= target_error;
+}
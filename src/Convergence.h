@@ -0,0 +1,68 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef CONVERGENCE_H
+#define CONVERGENCE_H
+
+#include <vector>
+
+/// Tracks the convergence of an impulse response that is rendered in
+/// batches of paths of equal size. The energy recorded by the paths of a
+/// batch is summed per time bin, the variation of these sums between the
+/// batches gives an estimate of the standard error of the energy in every
+/// bin. The relative error of the impulse response is the root mean square
+/// of the relative errors of the bins within 60 dB of the strongest bin.
+class Convergence {
+private:
+	int batch_size;
+	float target_error;
+	float bin_length;
+	int batches;
+	float error;
+	std::vector<double> batch;
+	std::vector<double> sum;
+	std::vector<double> sum_squared;
+public:
+	/// Creates a monitor for batches of batch_size paths, that are rendered
+	/// until the relative error is at most target_error. The energy is
+	/// summed in bins of bin_length seconds.
+	Convergence(int batch_size, float target_error, float bin_length = 0.01f);
+	/// Adds the intensity of a contribution that arrives at time t to the
+	/// current batch.
+	void Record(float t, float intensity) {
+		if ( t < 0.0f ) return;
+		const unsigned int bin = (unsigned int) (t / bin_length);
+		if ( bin >= batch.size() ) Grow(bin + 1);
+		batch[bin] += intensity < 0.0f ? -intensity : intensity;
+	}
+	/// Completes the current batch and returns whether the target error is
+	/// met. At least eight batches are needed to estimate the error.
+	bool EndBatch();
+	/// Adds the contributions of the current batch of other to the current
+	/// batch, for batches of which the paths are traced separately.
+	void Merge(const Convergence& other);
+	/// The number of paths in a batch
+	int batchSize() const { return batch_size; }
+	/// The relative error after the last completed batch
+	float getError() const { return error; }
+private:
+	void Grow(unsigned int bins);
+};
+
+#endif
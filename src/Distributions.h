@@ -28,6 +28,9 @@
 #ifndef DISTRIBUTIONS_H
 #define DISTRIBUTIONS_H
 
+#include <cmath>
+#include <algorithm>
+
 #include <gmtl/gmtl.h>
 #include <gmtl/Vec.h>
 
@@ -42,35 +45,56 @@
 #define INV_SPHERE_2(R) (1.0f / SHERE_SURFACE(R))
 #define INV_HEMI_2(R) (2.0f / SHERE_SURFACE(R))
 
-/// Samples a vector on a sphere. The implementation used here is very
-/// inefficient. A point in a unit cube is sampled and discarded if
-/// it falls outside a sphere with radius one.
-inline void Sample_Sphere(gmtl::Vec3f& v) {
-	const float f1 = gmtl::Math::unitRandom() * 2.0f - 1.0f;
-	const float f2 = gmtl::Math::unitRandom() * 2.0f - 1.0f;
-	const float f3 = gmtl::Math::unitRandom() * 2.0f - 1.0f;
-	v = gmtl::Vec3f(f1,f2,f3);
-	const float l = gmtl::lengthSquared(v);
-	if ( l < 0.001f || l > 1.0f ) {
-		return Sample_Sphere(v);
-	}
-	v /= sqrt(l);
+/// Maps the uniformly distributed numbers u1 and u2 in [0,1) to a vector
+/// v that is uniformly distributed on a sphere. Every pair of numbers maps
+/// to a single vector, so that a well distributed set of pairs results in
+/// a well distributed set of directions.
+inline void Sample_Sphere(gmtl::Vec3f& v, float u1, float u2) {
+	const float z = 1.0f - 2.0f * u1;
+	const float r = sqrt((std::max)(0.0f,1.0f - z * z));
+	const float phi = 2.0f * PI * u2;
+	v = gmtl::Vec3f(r * cos(phi),r * sin(phi),z);
 }
-/// Samples a vector on a hemisphere aligned by normal vector n, by
-/// first sampling a sphere and discarding the sample if the dot
-/// product with the normal vector is negative.
-inline void Sample_Hemi(gmtl::Vec3f& v, const gmtl::Vec3f& n) {
-	Sample_Sphere(v);
-	if ( gmtl::dot(n,v) < 0.0f ) {
-		return Sample_Hemi(v,n);
-	}
+/// Maps the uniformly distributed numbers u1 and u2 in [0,1) to a vector
+/// v that is uniformly distributed on a hemisphere aligned by normal
+/// vector n, which is assumed to be of unit length.
+inline void Sample_Hemi(gmtl::Vec3f& v, const gmtl::Vec3f& n, float u1, float u2) {
+	const float z = u1;
+	const float r = sqrt((std::max)(0.0f,1.0f - z * z));
+	const float phi = 2.0f * PI * u2;
+	const float x = r * cos(phi);
+	const float y = r * sin(phi);
+	// An orthonormal basis around n without branches on the orientation,
+	// Duff et al. 2017, Building an Orthonormal Basis, Revisited.
+	const float sign = n[2] >= 0.0f ? 1.0f : -1.0f;
+	const float a = -1.0f / (sign + n[2]);
+	const float b = n[0] * n[1] * a;
+	const gmtl::Vec3f t(1.0f + sign * n[0] * n[0] * a,sign * b,-sign * n[0]);
+	const gmtl::Vec3f s(b,sign + n[1] * n[1] * a,-n[1]);
+	v = t * x + s * y + n * z;
 }
 /// Samples a vector on a hemisphere aligned by normal vector n, but
 /// factors in a reflection vector as well, to account for a specular
 /// reflection component.
-inline void Sample_Hemi(gmtl::Vec3f& v, const gmtl::Vec3f& surface_normal,const gmtl::Vec3f& reflection,float factor) {
-	Sample_Hemi(v,surface_normal);
+inline void Sample_Hemi(gmtl::Vec3f& v, const gmtl::Vec3f& surface_normal,const gmtl::Vec3f& reflection,float factor, float u1, float u2) {
+	Sample_Hemi(v,surface_normal,u1,u2);
 	v = v * (1.0f - factor) + reflection * factor;
 	gmtl::normalize(v);
 }
+/// Returns the index of the cell that contains direction v when the faces
+/// of a cube are divided in resolution x resolution cells. Sorting rays on
+/// this index groups rays that travel in similar directions.
+inline unsigned int Direction_Cell(const gmtl::Vec3f& v, int resolution) {
+	const float ax = fabs(v[0]), ay = fabs(v[1]), az = fabs(v[2]);
+	int axis = 0;
+	if ( ay > ax && ay >= az ) axis = 1;
+	else if ( az > ax && az > ay ) axis = 2;
+	const float m = (std::max)((float) fabs(v[axis]),1e-20f);
+	const int face = axis * 2 + (v[axis] < 0.0f ? 1 : 0);
+	int cu = (int) ((v[(axis+1)%3] / m + 1.0f) * 0.5f * resolution);
+	int cv = (int) ((v[(axis+2)%3] / m + 1.0f) * 0.5f * resolution);
+	if ( cu >= resolution ) cu = resolution - 1;
+	if ( cv >= resolution ) cv = resolution - 1;
+	return (face * resolution + cu) * resolution + cv;
+}
 #endif
\ No newline at end of file
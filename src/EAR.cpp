@@ -35,6 +35,8 @@
 #include <gmtl/Intersection.h>
 
 #include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "../lib/wave/WaveFile.h"
 #include "../lib/equalizer/Equalizer.h"
@@ -49,13 +51,16 @@
 #include "Scene.h"
 #include "Material.h"
 #include "SceneContext.h"
+#include "RenderTask.h"
+#include "ThreadPool.h"
+#include "FFT.h"
+#include "Benchmark.h"
 
 using boost::thread;
 
-int Render(std::string filename, float* calc_T60=0, float* T60_Sabine=0, float* T60_Eyring=0) {
+int Render(std::string filename, float* calc_T60=0, float* T60_Sabine=0, float* T60_Eyring=0, bool resume=false) {
 	
-	// Init RNG, scene, and file input
-	gmtl::Math::seedRandom((unsigned int) time(0));
+	// Init scene and file input
 	Scene* scene = new Scene();
 	bool valid_file = Datatype::SetInput(filename);
 	if ( ! valid_file ) {
@@ -162,6 +167,109 @@ int Render(std::string filename, float* calc_T60=0, float* T60_Sabine=0, float*
 		scene->addMesh(Mesh::Empty());
 	}
 
+	// The linear scan over all triangles can be selected to compare the
+	// throughput of the renderer with and without acceleration structure.
+	const bool noacceleration = Settings::IsSet("noacceleration") && Settings::GetBool("noacceleration");
+	// The hierarchy is cached across runs for geometry that does not change
+	const std::string cachedir = Settings::IsSet("cachedir") ? Settings::GetString("cachedir") : "";
+	// Very large models can be stored at reduced precision to save memory
+	const bool compacthierarchy = Settings::IsSet("compacthierarchy") && Settings::GetBool("compacthierarchy");
+	const bool compacttriangles = Settings::IsSet("compacttriangles") && Settings::GetBool("compacttriangles");
+	scene->Prepare(!noacceleration,cachedir,compacthierarchy,compacttriangles);
+
+	// Paths can be traced in packets, preferably of 4, 8 or 16 rays to
+	// match the number of SIMD lanes, that traverse the hierarchy together.
+	if ( Settings::IsSet("packetsize") ) {
+		const int packet_size = Settings::GetInt("packetsize");
+		if ( packet_size < 0 || packet_size > MAX_PACKET_SIZE ) {
+			std::cout << std::endl << "Packet size should be at most " << MAX_PACKET_SIZE << std::endl << std::endl;
+			return 1;
+		}
+		scene->packet_size = packet_size;
+	}
+
+	// The engine that traces the paths: depth-first, one path at a time,
+	// in packets of paths, or breadth-first using a large pool of paths.
+	if ( Settings::IsSet("engine") ) {
+		const std::string engine = Settings::GetString("engine");
+		const bool has_packet_size = Settings::IsSet("packetsize");
+		if ( engine == "depthfirst" ) {
+			scene->packet_size = 0;
+		} else if ( engine == "packet" ) {
+			if ( !has_packet_size ) scene->packet_size = MAX_PACKET_SIZE;
+		} else if ( engine == "wavefront" ) {
+			if ( !has_packet_size ) scene->packet_size = MAX_PACKET_SIZE;
+			scene->wavefront_size = Settings::IsSet("wavefrontsize") ?
+				Settings::GetInt("wavefrontsize") : 4096;
+			if ( scene->wavefront_size < 1 ) {
+				std::cout << std::endl << "Wavefront size should be positive" << std::endl << std::endl;
+				return 1;
+			}
+		} else {
+			std::cout << std::endl << "Unknown engine '" << engine << "', expected depthfirst, packet or wavefront" << std::endl << std::endl;
+			return 1;
+		}
+	}
+
+	// The numbers from which the paths are sampled: pseudo random or quasi
+	// random from a scrambled Sobol sequence, which converges faster.
+	if ( Settings::IsSet("sampler") ) {
+		const std::string sampler = Settings::GetString("sampler");
+		if ( sampler == "random" ) {
+			scene->quasi_random = false;
+		} else if ( sampler == "sobol" ) {
+			scene->quasi_random = true;
+		} else {
+			std::cout << std::endl << "Unknown sampler '" << sampler << "', expected random or sobol" << std::endl << std::endl;
+			return 1;
+		}
+	}
+
+	// Paths with little energy left are terminated by Russian roulette, and
+	// paths that arrive after the end of the impulse response are not
+	// traced any further.
+	if ( Settings::IsSet("roulette") ) {
+		scene->roulette_threshold = Settings::GetFloat("roulette");
+	}
+	if ( Settings::IsSet("maxirlength") ) {
+		scene->max_ir_length = Settings::GetFloat("maxirlength");
+	}
+
+	// Rather than always tracing the number of samples, trace paths until
+	// the relative error of the impulse responses drops below targeterror.
+	// The number of samples is then the maximum number of paths traced.
+	if ( Settings::IsSet("targeterror") ) {
+		scene->target_error = Settings::GetFloat("targeterror");
+	}
+
+	// Long renders periodically store the partial impulse responses in
+	// checkpointdir, from which they can be resumed after an interruption
+	// or refined with additional samples.
+	if ( Settings::IsSet("checkpointdir") ) {
+		scene->checkpoint_dir = Settings::GetString("checkpointdir") + DIR_SEPERATOR;
+		if ( Settings::IsSet("checkpointinterval") ) {
+			scene->checkpoint_interval = Settings::GetFloat("checkpointinterval");
+		}
+	}
+	if ( resume ) {
+		if ( scene->checkpoint_dir.empty() ) {
+			std::cout << std::endl << "Resuming requires a checkpointdir setting" << std::endl << std::endl;
+			return 1;
+		}
+		scene->resume = true;
+	}
+
+	// The seed from which the random numbers of every impulse response are
+	// derived. Rendering a scene twice with the same seed gives identical
+	// results, regardless of the number of threads.
+	boost::uint64_t seed;
+	if ( Settings::IsSet("seed") ) {
+		seed = (boost::uint64_t) Settings::GetInt("seed");
+	} else {
+		seed = (boost::uint64_t) time(0);
+		std::cout << "Random seed: " << seed << std::endl;
+	}
+
 	Keyframes* keys = Keyframes::Get();
 
 	std::cout << "Rendering..." << std::endl;
@@ -178,7 +286,7 @@ int Render(std::string filename, float* calc_T60=0, float* T60_Sabine=0, float*
 				// we are only going to render the mid frequency range.
 				if ( calc_T60 && band_id != 1 ) continue;
 				const float absorption_factor = 1.0f-absorption[band_id];
-				SceneContext s(scene,band_id,sound_id,num_samples,absorption_factor,dry_level,keyframe_id);
+				SceneContext s(scene,band_id,sound_id,num_samples,absorption_factor,dry_level,keyframe_id,seed);
 				scs.push_back(s);
 			}
 			// If we are only here to calculate the T60 reverberation time
@@ -190,22 +298,62 @@ int Render(std::string filename, float* calc_T60=0, float* T60_Sabine=0, float*
 		if ( calc_T60 ) break;
 	}
 
-	if ( max_threads > 0 )
-		SetProgressBarSegments((int)ceil((float)scs.size()/(float)max_threads));
+	// The threads are created once and execute both the rendering and the
+	// processing of the impulse responses.
+	ThreadPool pool(max_threads);
+
+	const boost::posix_time::ptime render_start = boost::posix_time::microsec_clock::universal_time();
+#ifdef COUNT_ALLOCATIONS
+	const long render_allocations = AllocationCount();
+#endif
 
-	{std::vector<SceneContext>::const_iterator it = scs.begin();
-	while( true ) {
-		boost::thread_group group;
-		for ( int i = 0; max_threads < 0 || i < max_threads; i ++ ) {
-			group.create_thread(*it);
-			*it ++;
-			if ( it == scs.end() ) break;
+	// The paths of every context are divided into chunks. The chunks of the
+	// contexts are interleaved, so that the contexts progress together and
+	// their memory for chunks that wait to be added stays small.
+	{std::vector<RenderTask*> render_tasks;
+	int max_chunks = 0;
+	for( std::vector<SceneContext>::iterator it = scs.begin(); it != scs.end(); ++it ) {
+		render_tasks.push_back(new RenderTask(&*it));
+		max_chunks = (std::max)(max_chunks,render_tasks.back()->chunkCount());
+	}
+	std::vector<ThreadPool::Task> tasks;
+	for ( int chunk = 0; chunk < max_chunks; ++ chunk ) {
+		for ( std::vector<RenderTask*>::const_iterator it = render_tasks.begin(); it != render_tasks.end(); ++ it ) {
+			if ( chunk < (*it)->chunkCount() ) {
+				tasks.push_back(boost::bind(&RenderTask::Trace,*it,chunk,_1));
+			}
 		}
-		group.join_all();
-		if ( max_threads > 0 ) NextProgressBarSegment();
-		if ( it == scs.end() ) break;
+	}
+	ResetProgressBar((int)tasks.size());
+	pool.Run(tasks);
+	for ( std::vector<RenderTask*>::const_iterator it = render_tasks.begin(); it != render_tasks.end(); ++ it ) {
+		delete *it;
 	}}
 
+	{const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - render_start;
+	const double secs = elapsed.total_microseconds() / 1e6;
+	const double total_rays = (double) (scene->rays_traced + scene->shadow_rays_traced);
+	std::cout << std::endl << "Traced " << scene->rays_traced << " rays and " << scene->shadow_rays_traced << " shadow rays in " << secs << "s";
+	if ( secs > 0.0 ) std::cout << " (" << (int) (total_rays / secs) << " rays/s)";
+	std::cout << std::endl;
+	if ( scene->target_error > 0.0f || scene->resume ) {
+		for( std::vector<SceneContext>::const_iterator it = scs.begin(); it != scs.end(); ++it ) {
+			std::cout << " +- " << it->toString() << ": " << it->samples_traced << " of " << it->samples << " samples";
+			if ( scene->target_error > 0.0f ) std::cout << ", error " << it->error;
+			std::cout << std::endl;
+		}
+	}
+#ifdef COUNT_ALLOCATIONS
+	// Besides the threads and recorders only the buffers that hold the
+	// recorded samples should be allocated, the count should not grow with
+	// the number of samples.
+	const long allocations = AllocationCount() - render_allocations;
+	std::cout << "Allocated memory " << allocations << " times";
+	if ( total_rays > 0.0 ) std::cout << " (" << allocations / total_rays << " per ray)";
+	std::cout << std::endl;
+#endif
+	}
+
 	// Calculate max response
 	float max = 0.0f;
 	for( std::vector<SceneContext>::const_iterator it = scs.begin(); it != scs.end(); ++it ) {
@@ -327,57 +475,71 @@ int Render(std::string filename, float* calc_T60=0, float* T60_Sabine=0, float*
 
 	}
 	
-	if ( max_threads > 0 )
-		SetProgressBarSegments((int)ceil((float)rcs.size()/(float)max_threads));
-
-#ifdef USE_FFTW
-	// The creation of fftw plans is not thread safe, therefore fft convolution occurs
-	// sequentially. Note that the actual execution of plans is thread safe, hence
-	// fft convolution could be sped up by separating creation and execution of plans
-	// or using a mutex somewhere in the RecorderTrack class.
+	// Sound files are convoluted in the frequency domain, unless the time
+	// domain is requested, which interpolates the impulse responses of
+	// successive keyframes linearly rather than by fading the sound file.
+	if ( Settings::IsSet("convolution") ) {
+		const std::string convolution = Settings::GetString("convolution");
+		if ( convolution == "direct" ) {
+			RecorderTrack::direct_convolution = true;
+		} else if ( convolution != "fft" ) {
+			std::cout << std::endl << "Unknown convolution '" << convolution << "', expected fft or direct" << std::endl << std::endl;
+			return 1;
+		}
+	}
+
+	// The plans of the Fast Fourier Transforms are created once for every
+	// length and shared by the threads, see FFTPlans. Measured fftw plans
+	// are stored as wisdom in the file specified by fftwisdom, so that they
+	// only need to be measured once.
+	FFTPlans::Init(Settings::IsSet("fftwisdom") ? Settings::GetString("fftwisdom") : "");
+
+	{std::vector<ThreadPool::Task> tasks;
 	for ( std::vector<RecorderContext>::iterator it = rcs.begin(); it != rcs.end(); ++ it ) {
-		(*it)();
+		tasks.push_back(boost::bind(&RecorderContext::operator(),&*it));
 	}
-#else
-	{std::vector<RecorderContext>::const_iterator it = rcs.begin();
-	while( true ) {
-		boost::thread_group group;
-		for ( int i = 0; max_threads < 0 || i < max_threads; i ++ ) {
-			group.create_thread(*it);
-			*it ++;
-			if ( it == rcs.end() ) break;
-		}
-		group.join_all();
-		if ( max_threads > 0 ) NextProgressBarSegment();
-		if ( it == rcs.end() ) break;
-	}}
-	std::cout << std::endl;
-#endif
+	pool.Run(tasks);}
+
+	FFTPlans::Dispose();
 
 	std::cout << "Merging result..." << std::endl;
 
-	// Add buffers and save
-	int rec_id = 0;
-	for ( std::vector<Recorder*>::const_iterator it = scene->listeners.begin(); it != scene->listeners.end(); ++ it ) {
-		Recorder* r0 = *it;
-		Recorder* total = r0->getBlankCopy();
-		int scene_id = 0;
-		for( std::vector<SceneContext>::iterator it = scs.begin(); it != scs.end(); it ++ ) {
-			SceneContext sc = *it;
-			Recorder* other = sc.recorders[rec_id];
+	// The processed responses of the contexts are stored separately for
+	// debugging, before they are added together
+	for( std::vector<SceneContext>::iterator it = scs.begin(); it != scs.end(); it ++ ) {
+		for ( unsigned int rec_id = 0; rec_id < it->recorders.size(); ++ rec_id ) {
+			Recorder* other = it->recorders[rec_id];
 			other->save_processed = true;
 			if ( has_debugdir ) {
 				std::stringstream ss;
-				ss << debugdir << "rec-" << rec_id << ".sound-" << sc.soundfile_id;
-				if (sc.keyframe_id != -1) {
-					ss << ".frame-" << std::setw(2) << std::setfill('0') << sc.keyframe_id;
+				ss << debugdir << "rec-" << rec_id << ".sound-" << it->soundfile_id;
+				if (it->keyframe_id != -1) {
+					ss << ".frame-" << std::setw(2) << std::setfill('0') << it->keyframe_id;
 				}
-				ss << ".band-" << sc.band << ".wav";
+				ss << ".band-" << it->band << ".wav";
 				other->Save(ss.str());
 			}
-			total->Add(other);
-			scene_id ++;
 		}
+	}
+
+	// The responses of the contexts are added by a tree reduction on the
+	// threads. In every round the recorders of contexts that are step apart
+	// are added pairwise into the first one, until the first context holds
+	// the total. The order of the additions is fixed, so that the result
+	// does not depend on the number of threads.
+	for ( unsigned int step = 1; step < scs.size(); step *= 2 ) {
+		std::vector<ThreadPool::Task> tasks;
+		for ( unsigned int rec_id = 0; rec_id < scene->listeners.size(); ++ rec_id ) {
+			for ( unsigned int i = 0; i + step < scs.size(); i += 2*step ) {
+				tasks.push_back(boost::bind(&Recorder::Add,scs[i].recorders[rec_id],scs[i+step].recorders[rec_id]));
+			}
+		}
+		pool.Run(tasks);
+	}
+
+	int rec_id = 0;
+	for ( std::vector<Recorder*>::const_iterator it = scene->listeners.begin(); it != scene->listeners.end(); ++ it ) {
+		Recorder* total = scs.empty() ? (*it)->getBlankCopy() : scs[0].recorders[rec_id];
 		total->save_processed = true;
 		total->Normalize(0.8f);
 		total->Truncate(total->getLength(1e-6f));
@@ -385,6 +547,8 @@ int Render(std::string filename, float* calc_T60=0, float* T60_Sabine=0, float*
 		rec_id ++;
 	}
 
+	std::cout << "Peak memory usage " << PeakMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+
 	Datatype::Dispose();
 	Keyframes::Dispose();
 	delete scene;
@@ -400,9 +564,12 @@ int main(int argc, char** argv) {
 		const std::string arg1 = ((i+1)<argc) ? std::string(argv[i+1]) : "";
 		const std::string arg2 = ((i+2)<argc) ? std::string(argv[i+2]) : "";
 		if ( cmd == "render" && !arg1.empty() ) {
+			const bool resume = arg1 == "--resume";
+			const std::string filename = resume ? arg2 : arg1;
+			if ( filename.empty() ) break;
 			int ret_value = 1;
 			try {
-				ret_value = Render(arg1);
+				ret_value = Render(filename,0,0,0,resume);
 			} catch ( std::exception& e ) {
 				std::cout << std::endl << "Error: " << e.what() << std::endl << std::endl;
 			}
@@ -421,14 +588,15 @@ int main(int argc, char** argv) {
 				std::cout << std::endl << "Error: " << e.what() << std::endl << std::endl;				
 			}
 			return ret_value;
+		} else if ( cmd == "bench" && !arg1.empty() ) {
+			return Benchmark(arg1);
 		} else if ( cmd == "test" ) {
 			return 0;
 		}
 	}
 	std::cout << "Usage:" << std::endl
-		<< " EAR render <filename>" << std::endl
-		<< " EAR calc T60 <filename>" << std::endl;
+		<< " EAR render [--resume] <filename>" << std::endl
+		<< " EAR calc T60 <filename>" << std::endl
+		<< " EAR bench intersection|packets|compact|convergence|convolution|splat|chunks|allocations" << std::endl;
 }
 
-boost::mutex MonoRecorder::mutex;
-
@@ -0,0 +1,124 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <iostream>
+
+#include "FFT.h"
+#include "HelperFunctions.h"
+
+void* FFTMalloc(size_t size) {
+#ifdef USE_FFTW
+	return fftwf_malloc(size);
+#else
+	return AlignedMalloc(size);
+#endif
+}
+
+void FFTFree(void* p) {
+#ifdef USE_FFTW
+	fftwf_free(p);
+#else
+	AlignedFree(p);
+#endif
+}
+
+#ifdef USE_FFTW
+
+FFTPlan::FFTPlan(unsigned int l, bool measure) : n(l) {
+	// Measuring a plan overwrites the arrays, hence the plan is created for
+	// temporary arrays of the same alignment as the ones it is executed on.
+	const unsigned int flags = measure ? FFTW_MEASURE : FFTW_ESTIMATE;
+	float* a = (float*) fftwf_malloc(sizeof(float) * n);
+	fftwf_complex* A = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * (n/2+1));
+	forward = fftwf_plan_dft_r2c_1d(n,a,A,flags);
+	inverse = fftwf_plan_dft_c2r_1d(n,A,a,flags);
+	fftwf_free(a);
+	fftwf_free(A);
+}
+
+FFTPlan::~FFTPlan() {
+	fftwf_destroy_plan(forward);
+	fftwf_destroy_plan(inverse);
+}
+
+unsigned int FFTPlan::workSize() const {
+	return 0;
+}
+
+void FFTPlan::Forward(float* in, FFTComplex* out, float* work) const {
+	fftwf_execute_dft_r2c(forward,in,out);
+}
+
+void FFTPlan::Inverse(FFTComplex* in, float* out, float* work) const {
+	fftwf_execute_dft_c2r(inverse,in,out);
+}
+
+#else
+
+FFTPlan::FFTPlan(unsigned int l, bool measure) : n(l), fft(l) {}
+
+FFTPlan::~FFTPlan() {}
+
+unsigned int FFTPlan::workSize() const {
+	return fft.workSize();
+}
+
+void FFTPlan::Forward(float* in, FFTComplex* out, float* work) const {
+	fft.Forward(in,(float*)out,work);
+}
+
+void FFTPlan::Inverse(FFTComplex* in, float* out, float* work) const {
+	fft.Inverse((const float*)in,out,work);
+}
+
+#endif
+
+boost::mutex FFTPlans::mutex;
+FFTPlans::PlanMap FFTPlans::plans;
+std::string FFTPlans::wisdom_file;
+
+void FFTPlans::Init(const std::string& wisdom) {
+	boost::mutex::scoped_lock lock(mutex);
+	wisdom_file = wisdom;
+#ifdef USE_FFTW
+	if ( !wisdom_file.empty() && fftwf_import_wisdom_from_filename(wisdom_file.c_str()) ) {
+		std::cout << "Loaded fft wisdom from " << wisdom_file << std::endl;
+	}
+#endif
+}
+
+const FFTPlan& FFTPlans::Get(unsigned int n) {
+	boost::mutex::scoped_lock lock(mutex);
+	PlanMap::const_iterator it = plans.find(n);
+	if ( it != plans.end() ) return *it->second;
+	return *(plans[n] = new FFTPlan(n,!wisdom_file.empty()));
+}
+
+void FFTPlans::Dispose() {
+	boost::mutex::scoped_lock lock(mutex);
+	for ( PlanMap::const_iterator it = plans.begin(); it != plans.end(); ++ it ) {
+		delete it->second;
+	}
+	plans.clear();
+#ifdef USE_FFTW
+	if ( !wisdom_file.empty() && !fftwf_export_wisdom_to_filename(wisdom_file.c_str()) ) {
+		std::cout << "Failed to store fft wisdom to " << wisdom_file << std::endl;
+	}
+#endif
+}
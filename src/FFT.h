@@ -0,0 +1,105 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <map>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+/// Whether to use fftw for the Fast Fourier Transforms, rather than the
+/// built-in RealFFT
+// #define USE_FFTW
+
+#ifdef USE_FFTW
+#ifdef _MSC_VER
+#define FFTW_DLL
+#endif
+#include <fftw3.h>
+#else
+#include "../lib/fft/RealFFT.h"
+#endif
+
+/// Complex numbers are stored as pairs of floats, the same layout as
+/// fftwf_complex.
+typedef float FFTComplex[2];
+
+/// Allocates memory for the arrays that are transformed, aligned for the
+/// SIMD instructions of the transforms.
+void* FFTMalloc(size_t size);
+void FFTFree(void* p);
+
+/// The Fast Fourier Transforms of real sequences of a fixed length and
+/// back, executed by fftw if available and by RealFFT otherwise. The
+/// transforms can be executed by multiple threads at the same time on
+/// arrays allocated by FFTMalloc(), provided that every thread passes its
+/// own work array of workSize() floats.
+class FFTPlan {
+private:
+	unsigned int n;
+#ifdef USE_FFTW
+	fftwf_plan forward;
+	fftwf_plan inverse;
+#else
+	RealFFT fft;
+#endif
+	FFTPlan(const FFTPlan&);
+	FFTPlan& operator=(const FFTPlan&);
+public:
+	/// Plans the transforms of length n. Measured plans take longer to
+	/// create, but are faster, in case the backend supports it.
+	FFTPlan(unsigned int n, bool measure = false);
+	~FFTPlan();
+	/// The length of the real sequences
+	unsigned int size() const { return n; }
+	/// The number of floats in the work array passed to the transforms
+	unsigned int workSize() const;
+	/// Transforms n real numbers in in to n/2+1 complex numbers in out.
+	void Forward(float* in, FFTComplex* out, float* work) const;
+	/// Transforms n/2+1 complex numbers in in to n real numbers in out. The
+	/// result is not normalized, i.e. it is n times the sequence that was
+	/// transformed by Forward(). The transform may overwrite in.
+	void Inverse(FFTComplex* in, float* out, float* work) const;
+};
+
+/// Creates the plans for the transforms and keeps them for the remainder of
+/// the program, so that every length is planned only once. Creating plans
+/// is not thread safe in fftw, hence it is guarded by a mutex.
+class FFTPlans {
+private:
+	typedef std::map<unsigned int, FFTPlan*> PlanMap;
+	static boost::mutex mutex;
+	static PlanMap plans;
+	static std::string wisdom_file;
+public:
+	/// Loads the fftw wisdom from wisdom, unless it is empty. With wisdom,
+	/// the plans are measured rather than estimated, which takes longer
+	/// the first time a length is planned, but produces faster plans. The
+	/// wisdom is stored again by Dispose(). Without fftw, wisdom is not
+	/// used.
+	static void Init(const std::string& wisdom = "");
+	/// Returns the plan for the transforms of length n
+	static const FFTPlan& Get(unsigned int n);
+	/// Destroys the plans and stores the wisdom.
+	static void Dispose();
+};
+
+#endif
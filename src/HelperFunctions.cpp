@@ -23,9 +23,24 @@
 #include <fstream>
 #include <string>
 #include <stdexcept>
+#include <cstdlib>
+#include <new>
 
 #include <boost/thread/mutex.hpp>
 
+#ifdef COUNT_ALLOCATIONS
+#include <boost/detail/atomic_count.hpp>
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
 #include <gmtl/gmtl.h>
 
 #include "HelperFunctions.h"
@@ -54,17 +69,23 @@ std::string FileName(const std::string& str) {
 }
 
 boost::mutex cout_mutex;
-static int nsegments = 1;
-static int segment = 0;
-void SetProgressBarSegments(int n) { nsegments = n; segment = 0; }
-void NextProgressBarSegment() { ++ segment; }
-void DrawProgressBar(const int& done, const int& total) {
-	const int progress_update_interval = total / 50;
-	if ( ! (done % progress_update_interval) ) {
-		boost::mutex::scoped_lock lock(cout_mutex);
+static int progress_done = 0;
+static int progress_total = 0;
+void ResetProgressBar(int total) {
+	boost::mutex::scoped_lock lock(cout_mutex);
+	progress_done = 0;
+	progress_total = total;
+}
+void AdvanceProgressBar(int n) {
+	boost::mutex::scoped_lock lock(cout_mutex);
+	if ( progress_total <= 0 ) return;
+	const int before = progress_done * 49 / progress_total;
+	progress_done += n;
+	const int after = progress_done * 49 / progress_total;
+	if ( progress_done == n || after != before ) {
 		std::cout << "\r[";
-		for ( int _x = 0; _x < total - progress_update_interval; _x += progress_update_interval )
-			std::cout << ((nsegments*_x<done+segment*total) ? "=" : " ");
+		for ( int _x = 0; _x < 49; ++ _x )
+			std::cout << ((_x<after) ? "=" : " ");
 		std::cout << "]" << std::flush;
 	}
 }
@@ -72,4 +93,78 @@ void DrawProgressBar(const int& done, const int& total) {
 void DrawString(const std::string & s) {
 	boost::mutex::scoped_lock lock(cout_mutex);
 	std::cout << s;
-}
\ No newline at end of file
+}
+
+void* AlignedMalloc(size_t size, size_t alignment) {
+	// The address returned by malloc() is stored in front of the aligned
+	// block, so that it can be retrieved by AlignedFree()
+	char* p = (char*) malloc(size + alignment + sizeof(void*));
+	if ( !p ) throw std::bad_alloc();
+	char* aligned = p + sizeof(void*);
+	aligned += (alignment - ((size_t)aligned & (alignment - 1))) & (alignment - 1);
+	((void**)aligned)[-1] = p;
+	return aligned;
+}
+
+void AlignedFree(void* p) {
+	if ( p ) free(((void**)p)[-1]);
+}
+
+#ifdef COUNT_ALLOCATIONS
+
+static boost::detail::atomic_count allocation_count(0);
+
+// The exception specification of the replaced operators differs per version
+// of the standard
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#else
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define THROWS_NOTHING throw()
+#endif
+
+void* operator new(size_t size) THROWS_BAD_ALLOC {
+	++ allocation_count;
+	void* p = malloc(size ? size : 1);
+	if ( !p ) throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t size) THROWS_BAD_ALLOC {
+	return operator new(size);
+}
+void operator delete(void* p) THROWS_NOTHING {
+	free(p);
+}
+void operator delete[](void* p) THROWS_NOTHING {
+	free(p);
+}
+
+long AllocationCount() {
+	return allocation_count;
+}
+
+#else
+
+long AllocationCount() {
+	return 0;
+}
+
+#endif
+
+size_t PeakMemoryUsage() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if ( !GetProcessMemoryInfo(GetCurrentProcess(),&counters,sizeof(counters)) ) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if ( getrusage(RUSAGE_SELF,&usage) ) return 0;
+#ifdef __APPLE__
+	return (size_t) usage.ru_maxrss;
+#else
+	// Linux reports the maximum resident set size in kilobytes
+	return (size_t) usage.ru_maxrss * 1024;
+#endif
+#endif
+}
@@ -25,6 +25,7 @@
 #include <sstream>
 #include <fstream>
 #include <string>
+#include <cstddef>
 
 /// Splits a string into a part before and after the first space encountered
 bool Split(const std::string& str, std::string& a, std::string& b);
@@ -35,17 +36,34 @@ std::string DirName(const std::string& str);
 /// Returns the filename of a path
 std::string FileName(const std::string& str);
 
-/// Sets the number of segments for the progress bar in case the maximum
-/// number of threads is larger than the pool of tasks
-void SetProgressBarSegments(int n);
-/// Signals work on the first batch of tasks is done and moves to the next
-void NextProgressBarSegment();
-/// Draw a progress bar to stdout using appropriate locking for threads
-void DrawProgressBar(const int& done, const int& total);
+/// Starts a progress bar for a number of tasks that are executed by
+/// multiple threads, see AdvanceProgressBar()
+void ResetProgressBar(int total);
+/// Signals n tasks of the progress bar are done and draws the progress bar
+/// to stdout using appropriate locking for threads
+void AdvanceProgressBar(int n = 1);
 
 /// Draw a string to stdout using appropriate locking for threads
 void DrawString(const std::string & s);
 
+/// Allocates a block of memory of which the address is a multiple of
+/// alignment, which needs to be a power of two. The default of 64 bytes
+/// matches the size of a cache line and suffices for all SIMD widths.
+/// Memory needs to be released using AlignedFree()
+void* AlignedMalloc(size_t size, size_t alignment = 64);
+/// Releases memory allocated by AlignedMalloc()
+void AlignedFree(void* p);
+
+/// Returns the number of times memory has been allocated using operator new
+/// by all threads. Allocations are only counted when compiled with
+/// COUNT_ALLOCATIONS, which replaces the global operator new, otherwise zero
+/// is returned.
+long AllocationCount();
+
+/// Returns the largest amount of physical memory in bytes that has been
+/// used by the process so far, or zero in case it can not be determined.
+size_t PeakMemoryUsage();
+
 #ifdef _MSC_VER
 #define DIR_SEPERATOR "\\"
 #else
@@ -23,7 +23,8 @@
 
 #include "Material.h"
 
-Material::Material() {
+Material::Material(bool from_file) {
+	if ( ! from_file ) return;
 	Read(false);
 	assertid("MAT ");
 	name = ReadString();
@@ -68,16 +69,22 @@ Material::Material() {
 			if ( i < 2 ) std::cout << ", ";
 		}
 		std::cout << "]" << std::endl;
+	} else {
+		for( int i = 0; i < 3; i ++ )
+			specularity_coefficient[i] = 0.0f;
 	}
 }
 bool Material::isTransparent() {
 	return refraction_coefficient.size() == 3;
 }
-BounceType Material::Bounce(int band) {
+BounceType Material::Bounce(int band, float u) {
+	// The coefficients are looked up without inserting missing entries, as
+	// materials are shared by the rendering threads.
 	const float fl = reflection_coefficient[band];
-	const float fr = refraction_coefficient[band];
+	const std::map<int,float>::const_iterator r = refraction_coefficient.find(band);
+	const float fr = r == refraction_coefficient.end() ? 0.0f : r->second;
 	if ( fl < 0.0001 && fr < 0.0001 ) return REFLECT;
 	const float ab = 1.0f - fl - fr;
 	const float fl2 = fl / (fl+fr);
-	return ( gmtl::Math::unitRandom() <= fl2 ) ? REFLECT : REFRACT;
+	return ( u < fl2 ) ? REFLECT : REFRACT;
 }
\ No newline at end of file
@@ -37,9 +37,11 @@ public:
 	std::map<int,float> specularity_coefficient;
 	std::map<int,float>::iterator it;
 
-	Material();
+	/// Reads the material from the .EAR file, unless from_file is false, in
+	/// which case the coefficients need to be set for every band.
+	Material(bool from_file = true);
 	bool isTransparent();
-	BounceType Bounce(int band);
+	BounceType Bounce(int band, float u);
 };
 
 #endif
\ No newline at end of file
@@ -22,6 +22,9 @@
 #include <sstream>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <gmtl/Intersection.h>
 
@@ -30,44 +33,86 @@
 #include "Triangle.h"
 #include "Material.h"
 
-bool Mesh::RayIntersection(gmtl::Rayf* r,gmtl::Point3f* &p, gmtl::Vec3f* &n, Material* &mat) {
+bool Mesh::RayIntersection(const gmtl::Rayf& r, gmtl::Point3f& p, gmtl::Vec3f& n, Material*& mat) {
 	float d = 1000000;
-	float u,v,t;
-	bool x = false;
-	Triangle* tri;
-	std::vector<Triangle*>::const_iterator ti;
-	for(ti=tris.begin(); ti!=tris.end(); ++ti){
-		if ( gmtl::intersectDoubleSided(**ti,*r,u,v,t) && t > 0.001f && t < d ) {
-			d = t;
-			tri = *ti;
-			x = true;
-		}
+	unsigned int index;
+	bool x;
+	if ( compact_hierarchy ) {
+		x = compact_hierarchy->RayIntersection(*store,r,d,index);
+	} else if ( hierarchy ) {
+		x = hierarchy->RayIntersection(*store,r,d,index);
+	} else {
+		x = store->RayIntersection(r,0,store->size(),d,index);
 	}
 	if ( !x ) return false;
-	p = new gmtl::Point3f();
-	*p = r->mOrigin + r->mDir * d;
-	if ( gmtl::dot(tri->normal,r->mDir) > 0.0 ) {
-		n = new gmtl::Vec3f(tri->normal * -1.0f);
+	p = r.mOrigin + r.mDir * d;
+	const gmtl::Vec3f normal = store->getNormal(index);
+	if ( gmtl::dot(normal,r.mDir) > 0.0 ) {
+		n = normal * -1.0f;
 	} else {
-		n = new gmtl::Vec3f(tri->normal);
+		n = normal;
 	}
-	mat = tri->m;
+	mat = store->getMaterial(index);
 	return x;
 }
 
-bool Mesh::LineIntersection(gmtl::LineSegf* l) {
-	float u,v,t;
-	std::vector<Triangle*>::const_iterator ti;
-	for(ti=tris.begin(); ti!=tris.end(); ++ti){
-		// intersectDoubleSided is only defined for the gmtl::Ray type, therefore
-		// we need to check ourselves if t is within (0,1], which is the parametric
-		// range for the gmtl::LineSeg type.
-		if ( gmtl::intersectDoubleSided(**ti,*l,u,v,t) && t > 1e-5f && t < 1.0f ) {
-			return true;
+bool Mesh::LineIntersection(const gmtl::Point3f& a, const gmtl::Point3f& b) {
+	if ( compact_hierarchy ) return compact_hierarchy->Occluded(*store,a,b);
+	if ( hierarchy ) return hierarchy->Occluded(*store,a,b);
+	// The segment is expressed as a ray with an unnormalized direction,
+	// for which the parametric range of the segment is (0,1].
+	const gmtl::Vec3f dir = b - a;
+	return store->LineIntersection(gmtl::Rayf(a,dir),0,store->size());
+}
+
+void Mesh::RayIntersection(int count, const gmtl::Rayf* r, bool* hit, gmtl::Point3f* p, gmtl::Vec3f* n, Material** mat) {
+	float d[MAX_PACKET_SIZE];
+	unsigned int index[MAX_PACKET_SIZE];
+	for ( int i = 0; i < count; ++ i ) d[i] = 1000000;
+	if ( compact_hierarchy ) {
+		for ( int i = 0; i < count; ++ i ) {
+			hit[i] = compact_hierarchy->RayIntersection(*store,r[i],d[i],index[i]);
 		}
+	} else if ( hierarchy && count == 1 ) {
+		hit[0] = hierarchy->RayIntersection(*store,r[0],d[0],index[0]);
+	} else if ( hierarchy ) {
+		hierarchy->RayIntersection(*store,count,r,d,index,hit);
+	} else {
+		for ( int i = 0; i < count; ++ i ) {
+			hit[i] = store->RayIntersection(r[i],0,store->size(),d[i],index[i]);
+		}
+	}
+	for ( int i = 0; i < count; ++ i ) {
+		if ( !hit[i] ) continue;
+		p[i] = r[i].mOrigin + r[i].mDir * d[i];
+		const gmtl::Vec3f normal = store->getNormal(index[i]);
+		if ( gmtl::dot(normal,r[i].mDir) > 0.0 ) {
+			n[i] = normal * -1.0f;
+		} else {
+			n[i] = normal;
+		}
+		mat[i] = store->getMaterial(index[i]);
+	}
+}
 
+void Mesh::LineIntersection(int count, const gmtl::Point3f* a, const gmtl::Point3f& b, bool* blocked) {
+	if ( hierarchy && !compact_hierarchy && count > 1 ) {
+		hierarchy->Occluded(*store,count,a,b,blocked);
+	} else {
+		for ( int i = 0; i < count; ++ i ) {
+			blocked[i] = LineIntersection(a[i],b);
+		}
+	}
+}
+
+void Mesh::LineIntersection(int count, const gmtl::Point3f& a, const gmtl::Point3f* b, bool* blocked) {
+	if ( hierarchy && !compact_hierarchy && count > 1 ) {
+		hierarchy->Occluded(*store,count,a,b,blocked);
+	} else {
+		for ( int i = 0; i < count; ++ i ) {
+			blocked[i] = LineIntersection(a,b[i]);
+		}
 	}
-	return false;
 }
 
 Mesh* Mesh::Empty() {
@@ -75,6 +120,9 @@ Mesh* Mesh::Empty() {
 }
 
 Mesh::Mesh(bool from_file) {
+	hierarchy = 0;
+	compact_hierarchy = 0;
+	store = 0;
 	total_area = 0;
 	total_weighted_area = 0;
 	if ( ! from_file ) return;
@@ -108,6 +156,9 @@ Mesh::Mesh(bool from_file) {
 }
 
 Mesh::~Mesh() {
+	delete hierarchy;
+	delete compact_hierarchy;
+	delete store;
 	for ( std::vector<Triangle*>::const_iterator it = tris.begin(); it != tris.end(); ++ it ) {
 		delete *it;
 	}	
@@ -140,17 +191,114 @@ void Mesh::BoundingBox() {
 	has_boundingbox = true;
 }
 
-void Mesh::SamplePoint(gmtl::Point3f& p, gmtl::Vec3f& n) {
-	float x = gmtl::Math::rangeRandom(0,total_area);
-	std::vector<Triangle*>::const_iterator it;
-	for( it = tris.begin(); it != tris.end(); it ++ ) {
-		x -= (*it)->area;
-		if ( x < 0 ) {
-			(*it)->SamplePoint(p);
-			n = (*it)->normal;
-			break;
+void Mesh::Prepare(bool build_hierarchy, const std::string& cache_dir, bool compact_nodes, bool compact_triangles) {
+	delete hierarchy;
+	delete compact_hierarchy;
+	delete store;
+	hierarchy = 0;
+	compact_hierarchy = 0;
+	if ( build_hierarchy ) {
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		std::string cache_file;
+		boost::uint64_t hash = 0;
+		if ( !cache_dir.empty() ) {
+			hash = BVH::Hash(tris);
+			std::stringstream ss;
+			ss << cache_dir << DIR_SEPERATOR << "hierarchy-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bvh";
+			cache_file = ss.str();
+			hierarchy = BVH::Load(cache_file,tris,hash);
+		}
+		const bool from_cache = hierarchy != 0;
+		if ( !from_cache ) hierarchy = new BVH(tris);
+		boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+		std::cout << hierarchy->toString();
+		std::cout << " +- " << (from_cache ? "load" : "build") << " time: " << elapsed.total_microseconds() / 1e6 << "s" << std::endl;
+		if ( !cache_file.empty() ) {
+			if ( from_cache ) {
+				std::cout << " +- cache: " << cache_file << std::endl;
+			} else if ( !hierarchy->Save(cache_file,hash) ) {
+				std::cout << "Warning: failed to write hierarchy to " << cache_file << std::endl;
+			}
+		}
+
+		const float num_tris = (float) (std::max)((size_t) 1,tris.size());
+		const size_t full_node_bytes = hierarchy->NodeCount() * sizeof(BVHNode);
+		const size_t full_store_bytes = TriangleStore::byteSize((unsigned int) tris.size(),true);
+		size_t node_bytes = full_node_bytes;
+
+		if ( compact_nodes ) {
+			// The binary hierarchy is only needed to build the compact one,
+			// which also determines the order of the triangles in the store.
+			start = boost::posix_time::microsec_clock::universal_time();
+			compact_hierarchy = new WideBVH(*hierarchy);
+			elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+			std::cout << compact_hierarchy->toString();
+			std::cout << " +- build time: " << elapsed.total_microseconds() / 1e6 << "s" << std::endl;
+			store = new TriangleStore(compact_hierarchy->getTriangles(),!compact_triangles);
+			node_bytes = compact_hierarchy->NodeCount() * sizeof(WideBVHNode);
+			delete hierarchy;
+			hierarchy = 0;
+		} else {
+			store = new TriangleStore(hierarchy->getTriangles(),!compact_triangles);
+		}
+
+		std::cout << " +- memory per triangle: " << (node_bytes + store->byteSize()) / num_tris << " bytes (hierarchy "
+			<< node_bytes / num_tris << ", triangles " << store->byteSize() / num_tris << ")" << std::endl;
+		if ( compact_nodes || compact_triangles ) {
+			std::cout << " +- full precision: " << (full_node_bytes + full_store_bytes) / num_tris << " bytes (hierarchy "
+				<< full_node_bytes / num_tris << ", triangles " << full_store_bytes / num_tris << ")" << std::endl;
 		}
+	} else {
+		store = new TriangleStore(tris,!compact_triangles);
+	}
+}
+
+void Mesh::PrepareSampling() {
+	// Every triangle is assigned a column with a probability of 1/n, the
+	// columns are filled up to the average area with the area of the
+	// triangle itself and the remainder is taken from a single triangle
+	// with an area above average, its alias.
+	const unsigned int n = (unsigned int) tris.size();
+	alias_threshold.assign(n,1.0f);
+	alias_index.resize(n);
+	double total = 0.0;
+	for ( unsigned int i = 0; i < n; ++ i ) {
+		total += tris[i]->area;
+		alias_index[i] = i;
+	}
+	if ( total <= 0.0 ) return;
+	std::vector<double> scaled(n);
+	std::vector<unsigned int> below, above;
+	for ( unsigned int i = 0; i < n; ++ i ) {
+		scaled[i] = (double) tris[i]->area * n / total;
+		if ( scaled[i] < 1.0 ) below.push_back(i);
+		else above.push_back(i);
 	}
+	while ( !below.empty() && !above.empty() ) {
+		const unsigned int s = below.back(); below.pop_back();
+		const unsigned int l = above.back();
+		alias_threshold[s] = (float) scaled[s];
+		alias_index[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if ( scaled[l] < 1.0 ) {
+			above.pop_back();
+			below.push_back(l);
+		}
+	}
+	// The columns that remain are full up to rounding errors
+}
+
+void Mesh::SamplePoint(gmtl::Point3f& p, gmtl::Vec3f& n, Sampler& sampler) {
+	const unsigned int size = (unsigned int) alias_index.size();
+	if ( !size ) return;
+	unsigned int i = (unsigned int) (sampler.Get1D() * size);
+	if ( i >= size ) i = size - 1;
+	if ( sampler.Get1D() >= alias_threshold[i] ) i = alias_index[i];
+	Triangle* t = tris[i];
+	float u1, u2;
+	sampler.Get2D(u1,u2);
+	t->SamplePoint(p,u1,u2);
+	n = t->normal;
 }
 
 float Mesh::Area() const {
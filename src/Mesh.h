@@ -30,6 +30,10 @@
 #include "HelperFunctions.h"
 #include "Triangle.h"
 #include "Material.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "TriangleStore.h"
+#include "Sampler.h"
 
 /// This class defines a set of triangles that together make an object
 /// that reflects sound rays. The volume does not need to be closed and
@@ -43,6 +47,13 @@ private:
 	bool has_boundingbox;
 	float total_area;
 	float total_weighted_area;
+	BVH* hierarchy;
+	WideBVH* compact_hierarchy;
+	TriangleStore* store;
+	/// The alias table for sampling triangles proportional to their area,
+	/// see PrepareSampling().
+	std::vector<float> alias_threshold;
+	std::vector<unsigned int> alias_index;
 public:
 	std::vector<Triangle*> tris;
 	Material* material;
@@ -51,14 +62,50 @@ public:
 	
 	float xmin,ymin,zmin,xmax,ymax,zmax;
 
-	bool RayIntersection(gmtl::Rayf* r,gmtl::Point3f* &p, gmtl::Vec3f* &n, Material* &mat) ;
-	bool LineIntersection(gmtl::LineSegf* l);
-	void SamplePoint(gmtl::Point3f& p, gmtl::Vec3f& n);
+	/// Intersects the ray with the triangles of the mesh. In case a triangle
+	/// is hit, the hit point, the normal of the triangle facing the origin of
+	/// the ray and its material are written to p, n and mat.
+	bool RayIntersection(const gmtl::Rayf& r, gmtl::Point3f& p, gmtl::Vec3f& n, Material*& mat);
+	/// Returns whether the line segment between a and b is blocked by any
+	/// of the triangles in the mesh.
+	bool LineIntersection(const gmtl::Point3f& a, const gmtl::Point3f& b);
+	/// Intersects a packet of n rays, at most MAX_PACKET_SIZE, with the mesh at
+	/// once. For every ray hit is set to whether a triangle is hit and if so the
+	/// hit point, surface normal and material are written to p, n and mat, with
+	/// the same semantics as the single ray variant of RayIntersection().
+	void RayIntersection(int count, const gmtl::Rayf* r, bool* hit, gmtl::Point3f* p, gmtl::Vec3f* n, Material** mat);
+	/// Tests the line segments from every point in a to point b for occlusion
+	/// at once, where a contains count points, at most MAX_PACKET_SIZE.
+	void LineIntersection(int count, const gmtl::Point3f* a, const gmtl::Point3f& b, bool* blocked);
+	/// Tests the line segments from point a to every point in b for occlusion
+	/// at once, where b contains count points, at most MAX_PACKET_SIZE.
+	void LineIntersection(int count, const gmtl::Point3f& a, const gmtl::Point3f* b, bool* blocked);
+	/// Builds the table used by SamplePoint() to select a triangle with a
+	/// probability proportional to its area in constant time, using the alias
+	/// method. This needs to be called before the mesh is used as an emitting
+	/// surface and after all triangles have been added.
+	void PrepareSampling();
+	/// Samples a point p uniformly distributed over the surface of the mesh
+	/// and returns the normal n of the triangle it lies on.
+	void SamplePoint(gmtl::Point3f& p, gmtl::Vec3f& n, Sampler& sampler);
 	Mesh(bool from_file = true);
 	~Mesh();
 	static Mesh* Empty();
 	void Combine(Mesh* m);
 	void BoundingBox();
+	/// Copies the triangles into a compact triangle store, which is used by
+	/// RayIntersection() and LineIntersection() from then on. Unless
+	/// build_hierarchy is false, a bounding volume hierarchy is built as well
+	/// and the triangles are stored in the order of its leaves. Triangles
+	/// should not be added to the mesh after it has been prepared. In case
+	/// cache_dir is not empty, the hierarchy is loaded from a cache file in
+	/// that directory for triangles that have been prepared before, otherwise
+	/// the hierarchy is written to it after it has been built. For very large
+	/// models compact_nodes collapses the hierarchy into a WideBVH, which
+	/// takes less memory, but is traversed one ray at a time, also by the
+	/// packet variants of RayIntersection() and LineIntersection(), and
+	/// compact_triangles leaves the normals out of the triangle store.
+	void Prepare(bool build_hierarchy = true, const std::string& cache_dir = "", bool compact_nodes = false, bool compact_triangles = false);
 	/// Returns the surface area of the mesh, useful for example to determine the T60
 	/// reverberation time using Sabine, Eyring or Millington-Sette.
 	float Area() const;
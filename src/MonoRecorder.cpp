@@ -21,8 +21,6 @@
 #include <iostream>
 #include <fstream>
 
-#include "boost/thread/thread.hpp"
-
 #include "../lib/wave/WaveFile.h"
 
 #include "SoundFile.h"
@@ -35,7 +33,7 @@ std::string MonoRecorder::getFilename() { return filename; }
 void MonoRecorder::setFilename(const std::string& s) { filename = s; }
 int MonoRecorder::trackCount() { return 1; }
 
-MonoRecorder::MonoRecorder(bool fromFile) {
+MonoRecorder::MonoRecorder(bool fromFile, unsigned int reserve) {
 	is_truncated = is_processed = false;
 	if ( fromFile ) {
 		stamped_offset = 0;
@@ -55,10 +53,10 @@ MonoRecorder::MonoRecorder(bool fromFile) {
 		filename = "";
 	}
 	has_samples = save_processed = false;
-	tracks.push_back(new RecorderTrack());
+	tracks.push_back(new RecorderTrack(reserve));
 }
-Recorder* MonoRecorder::getBlankCopy(int secs) {
-	MonoRecorder* r = new MonoRecorder(false);
+Recorder* MonoRecorder::getBlankCopy(unsigned int reserve) {
+	MonoRecorder* r = new MonoRecorder(false,reserve);
 	r->stamped_offset = 0;
 	r->filename = filename;
 	r->location = location;
@@ -69,7 +67,10 @@ Recorder* MonoRecorder::getBlankCopy(int secs) {
 bool MonoRecorder::Save(const std::string& fn, bool norm, float norm_max) {
 	WaveFile w;
 	const RecorderTrack& to_save = *(save_processed ? processed_tracks[0] : tracks[0]);
-	w.FromFloat(&to_save[0],to_save.getLength(),norm,norm_max);
+	// The samples are stored in pages, which are copied to a contiguous array
+	std::vector<float> samples(to_save.getLength()+1);
+	to_save.CopyTo(&samples[0],0,samples.size());
+	w.FromFloat(&samples[0],to_save.getLength(),norm,norm_max);
 	w.Save(fn.c_str());
 	return true;
 }
@@ -80,19 +81,17 @@ inline void MonoRecorder::_Sample(int i, float v) {
 	this->tracks[0]->operator [](i) += v;
 	has_samples = true;
 }
-void MonoRecorder::Record(const gmtl::Vec3f& dir, float a, float t, float dist, int band, int kf) {
-	const int s = (int) (t*44100.0);
+void MonoRecorder::Splat(const Contribution& c) {
+	const int s = (int) (c.t*44100.0);
 #ifdef USE_FILTER	
-	const float width = sqrt(dist);
-	float ampl = 2.0f * a / width;
+	const float width = sqrt(c.dist);
+	const float ampl = 2.0f * c.ampl / width;
 	const int w = (int) ceil(width);
 	const float step = ampl / w;
-	for ( int i = 0; i < w; ++ i ) {
-		_Sample(i+s,ampl);
-		ampl -= step;
-	}
+	tracks[0]->Splat(s,w,ampl,step);
+	has_samples = true;
 #else
-	_Sample(s,a);
+	_Sample(s,c.ampl);
 #endif
 }
 void MonoRecorder::setLocation(gmtl::Point3f p) {
@@ -24,8 +24,6 @@
 #include <iostream>
 #include <fstream>
 
-#include "boost/thread/thread.hpp"
-
 #include "../lib/wave/WaveFile.h"
 
 #include "SoundFile.h"
@@ -35,8 +33,6 @@
 /// point. It therefore has no orientation and captures sound from every
 /// direction.
 class MonoRecorder : public Datatype, public Recorder {
-private:
-	static boost::mutex mutex;
 public:
 	gmtl::Point3f location;
 	std::string filename;
@@ -47,12 +43,13 @@ public:
 	void setFilename(const std::string& s);
 	int trackCount();
 	
-	MonoRecorder(bool fromFile = true);
-	Recorder* getBlankCopy(int secs = -1);
+	/// Reads the recorder from the file in case fromFile is set. The tracks
+	/// reserve room for the number of samples in reserve, see FloatBuffer.
+	MonoRecorder(bool fromFile = true, unsigned int reserve = 0);
+	Recorder* getBlankCopy(unsigned int reserve = 0);
 	bool Save(const std::string& fn, bool norm = true, float norm_max = 1.0f);
 	bool Save();
 	inline void _Sample(int i, float v);
-	void Record(const gmtl::Vec3f& dir, float ampl, float t, float dist, int band, int kf);
 	void setLocation(gmtl::Point3f p);
 	bool isAnimated();
 	//gmtl::Point3f getLocation();
@@ -60,6 +57,8 @@ public:
 	float getSegmentLength(int i);
 	std::string toString();
 	Animated<gmtl::Point3f>* getAnimationData();
+protected:
+	void Splat(const Contribution& c);
 };
 
 #endif
\ No newline at end of file
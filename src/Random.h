@@ -0,0 +1,90 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <boost/cstdint.hpp>
+
+/// A fast pseudo random number generator (xoshiro128+) of which every render
+/// thread owns an instance, as opposed to the global generator of the C
+/// library, which is shared by all threads. The state is only 16 bytes and
+/// the sequence of numbers is fully determined by the seed, so that renders
+/// with the same seed give identical results regardless of the number of
+/// threads.
+class RandomGenerator {
+private:
+	boost::uint32_t s[4];
+	static boost::uint32_t rotl(boost::uint32_t x, int k) {
+		return (x << k) | (x >> (32 - k));
+	}
+	/// The SplitMix64 generator, which turns similar seeds into unrelated
+	/// states.
+	static boost::uint64_t SplitMix(boost::uint64_t& x) {
+		boost::uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+public:
+	RandomGenerator(boost::uint64_t seed = 0) {
+		Seed(seed);
+	}
+	void Seed(boost::uint64_t seed) {
+		const boost::uint64_t a = SplitMix(seed);
+		const boost::uint64_t b = SplitMix(seed);
+		s[0] = (boost::uint32_t) a; s[1] = (boost::uint32_t) (a >> 32);
+		s[2] = (boost::uint32_t) b; s[3] = (boost::uint32_t) (b >> 32);
+	}
+	/// Derives the seed for a single render task, identified by the sound
+	/// source, keyframe and frequency band, from the seed of the render.
+	static boost::uint64_t DeriveSeed(boost::uint64_t seed, int sound, int keyframe, int band) {
+		boost::uint64_t x = seed;
+		x = SplitMix(x) ^ (boost::uint64_t) (boost::uint32_t) sound;
+		x = SplitMix(x) ^ (boost::uint64_t) (boost::uint32_t) keyframe;
+		x = SplitMix(x) ^ (boost::uint64_t) (boost::uint32_t) band;
+		return SplitMix(x);
+	}
+	/// Derives the seed for the paths from first_path onwards of a render
+	/// task from the seed of the task.
+	static boost::uint64_t DeriveSeed(boost::uint64_t seed, boost::uint32_t first_path) {
+		boost::uint64_t x = seed;
+		x = SplitMix(x) ^ (boost::uint64_t) first_path;
+		return SplitMix(x);
+	}
+	/// Returns 32 random bits
+	boost::uint32_t Next() {
+		const boost::uint32_t result = s[0] + s[3];
+		const boost::uint32_t t = s[1] << 9;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3],11);
+		return result;
+	}
+	/// Returns a uniformly distributed number in [0,1)
+	float Uniform() {
+		// The upper 24 bits fill the mantissa of a float exactly
+		return (Next() >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+#endif
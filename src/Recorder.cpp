@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#include <stdexcept>
 
 #include <gmtl/gmtl.h>
 #include <gmtl/Vec.h>
@@ -29,62 +30,310 @@
 #include "Recorder.h"
 #include "Animated.h"
 #include "SoundFile.h"
+#include "FFT.h"
+#include "SIMD.h"
+#include "HelperFunctions.h"
+
+namespace {
+	// Adds the n samples in b to the samples in a, both aligned to 64
+	// bytes, n is a multiple of 16.
+#if defined(SIMD_SSE) || defined(SIMD_AVX)
+	template <typename L>
+	void AddSamplesLanes(float* a, const float* b, unsigned int n) {
+		const unsigned int w = L::width;
+		for ( unsigned int i = 0; i < n; i += 2*w ) {
+			L::store(a+i,L::add(L::load(a+i),L::load(b+i)));
+			L::store(a+i+w,L::add(L::load(a+i+w),L::load(b+i+w)));
+		}
+	}
+#endif
+
+	void AddSamples(float* a, const float* b, unsigned int n) {
+#if defined(SIMD_AVX)
+		AddSamplesLanes<AVXLanes>(a,b,n);
+#elif defined(SIMD_SSE)
+		AddSamplesLanes<SSELanes>(a,b,n);
+#else
+		for ( unsigned int i = 0; i < n; ++ i ) {
+			a[i] += b[i];
+		}
+#endif
+	}
+
+	// Sorts the contributions by the sample at which they arrive using a
+	// least significant digit radix sort of 8 bits per pass. The sort is
+	// stable, so that contributions that arrive at the same sample are
+	// added in the order in which they were recorded. Passes for digits that
+	// are equal for all contributions, such as the high digits for short
+	// responses, are skipped.
+	void SortContributions(std::vector<Contribution>& log, std::vector<Contribution>& scratch) {
+		const size_t n = log.size();
+		size_t counts[4][256];
+		memset(counts,0,sizeof(counts));
+		for ( size_t i = 0; i < n; ++ i ) {
+			const unsigned int key = log[i].sample;
+			for ( int d = 0; d < 4; ++ d ) {
+				++ counts[d][(key >> (8*d)) & 0xff];
+			}
+		}
+		scratch.resize(n);
+		for ( int d = 0; d < 4; ++ d ) {
+			const int shift = 8*d;
+			if ( counts[d][(log[0].sample >> shift) & 0xff] == n ) continue;
+			size_t offsets[256];
+			size_t offset = 0;
+			for ( int b = 0; b < 256; ++ b ) {
+				offsets[b] = offset;
+				offset += counts[d][b];
+			}
+			for ( size_t i = 0; i < n; ++ i ) {
+				scratch[offsets[(log[i].sample >> shift) & 0xff]++] = log[i];
+			}
+			log.swap(scratch);
+		}
+	}
+
+	// The direct convolution accumulates the output in tiles of
+	// CONVOLUTION_TILE samples, over blocks of CONVOLUTION_TAPS taps of the
+	// impulse response, so that the tile of output, the block of taps and
+	// the input samples they combine stay in the L1 cache.
+	const unsigned int CONVOLUTION_TILE = 1024;
+	const unsigned int CONVOLUTION_TAPS = 1024;
+	// The output is padded to a multiple of the widest lanes times the
+	// number of accumulators, so that the kernels need no remainder loop.
+	const unsigned int CONVOLUTION_STEP = 32;
+
+	// Accumulates y[k] += sum h[j] * x[k+j] over the m taps in h for the n
+	// samples in y. The taps in h are reversed, x is padded with zeros by
+	// m-1 samples in front and m+CONVOLUTION_STEP samples in the back. In
+	// case x2 is set, the products of x2 and h2 are accumulated as well.
+#if defined(SIMD_SSE) || defined(SIMD_AVX)
+	template <typename L>
+	void ConvolveLanes(const float* x, const float* h, const float* x2, const float* h2, unsigned int m, float* y, unsigned int n) {
+		typedef typename L::type T;
+		const unsigned int w = L::width;
+		for ( unsigned int k0 = 0; k0 < n; k0 += CONVOLUTION_TILE ) {
+			const unsigned int k1 = (std::min)(k0+CONVOLUTION_TILE,n);
+			for ( unsigned int j0 = 0; j0 < m; j0 += CONVOLUTION_TAPS ) {
+				const unsigned int j1 = (std::min)(j0+CONVOLUTION_TAPS,m);
+				for ( unsigned int k = k0; k < k1; k += 4*w ) {
+					T a0 = L::load(y+k), a1 = L::load(y+k+w);
+					T a2 = L::load(y+k+2*w), a3 = L::load(y+k+3*w);
+					for ( unsigned int j = j0; j < j1; ++ j ) {
+						const T t = L::set(h[j]);
+						const float* p = x+k+j;
+						a0 = L::madd(t,L::loadu(p),a0);
+						a1 = L::madd(t,L::loadu(p+w),a1);
+						a2 = L::madd(t,L::loadu(p+2*w),a2);
+						a3 = L::madd(t,L::loadu(p+3*w),a3);
+					}
+					if ( x2 ) {
+						for ( unsigned int j = j0; j < j1; ++ j ) {
+							const T t = L::set(h2[j]);
+							const float* p = x2+k+j;
+							a0 = L::madd(t,L::loadu(p),a0);
+							a1 = L::madd(t,L::loadu(p+w),a1);
+							a2 = L::madd(t,L::loadu(p+2*w),a2);
+							a3 = L::madd(t,L::loadu(p+3*w),a3);
+						}
+					}
+					L::store(y+k,a0); L::store(y+k+w,a1);
+					L::store(y+k+2*w,a2); L::store(y+k+3*w,a3);
+				}
+			}
+		}
+	}
+
+#else
+	// One output sample at a time without SIMD
+	void ConvolveScalar(const float* x, const float* h, const float* x2, const float* h2, unsigned int m, float* y, unsigned int n) {
+		for ( unsigned int k0 = 0; k0 < n; k0 += CONVOLUTION_TILE ) {
+			const unsigned int k1 = (std::min)(k0+CONVOLUTION_TILE,n);
+			for ( unsigned int j0 = 0; j0 < m; j0 += CONVOLUTION_TAPS ) {
+				const unsigned int j1 = (std::min)(j0+CONVOLUTION_TAPS,m);
+				for ( unsigned int k = k0; k < k1; ++ k ) {
+					float a = y[k];
+					for ( unsigned int j = j0; j < j1; ++ j ) {
+						a += h[j] * x[k+j];
+					}
+					if ( x2 ) {
+						for ( unsigned int j = j0; j < j1; ++ j ) {
+							a += h2[j] * x2[k+j];
+						}
+					}
+					y[k] = a;
+				}
+			}
+		}
+	}
+#endif
+
+	// Convolves the n samples of sound with the m samples of the responses
+	// h and, if set, h2, starting at sample first of the responses, into a
+	// new track at offset. The sound is weighted per sample by f0 + df * i
+	// for h and by 1 - f0 - df * i for h2, which linearly interpolates from
+	// the response in h to the response in h2 over the length of the sound.
+	RecorderTrack* Convolve(const float* sound, unsigned int n, unsigned int offset,
+	                        const RecorderTrack* h, const RecorderTrack* h2,
+	                        unsigned int first, unsigned int m, float f0, float df) {
+		if ( !m || !n ) return new RecorderTrack();
+		const unsigned int mn = m+n-1;
+		const unsigned int padded = (mn+CONVOLUTION_STEP-1) / CONVOLUTION_STEP * CONVOLUTION_STEP;
+		const unsigned int inputs = h2 ? 2 : 1;
+		const unsigned int input_length = padded+m+CONVOLUTION_STEP;
+
+		float* y = (float*) AlignedMalloc(sizeof(float) * padded);
+		float* x = (float*) AlignedMalloc(sizeof(float) * input_length * inputs);
+		float* taps = (float*) AlignedMalloc(sizeof(float) * m * inputs);
+		memset(y,0,sizeof(float) * padded);
+		memset(x,0,sizeof(float) * input_length * inputs);
+		h->CopyTo(taps,first,m);
+		std::reverse(taps,taps+m);
+		for ( unsigned int i = 0; i < n; ++ i ) {
+			x[m-1+i] = sound[i] * (f0 + df * (float) i);
+		}
+		if ( h2 ) {
+			h2->CopyTo(taps+m,first,m);
+			std::reverse(taps+m,taps+2*m);
+			for ( unsigned int i = 0; i < n; ++ i ) {
+				x[input_length+m-1+i] = sound[i] * (1.0f - f0 - df * (float) i);
+			}
+		}
+
+		const float* x2 = h2 ? x+input_length : 0;
+		const float* taps2 = h2 ? taps+m : 0;
+#if defined(SIMD_AVX)
+		ConvolveLanes<AVXLanes>(x,taps,x2,taps2,m,y,padded);
+#elif defined(SIMD_SSE)
+		ConvolveLanes<SSELanes>(x,taps,x2,taps2,m,y,padded);
+#else
+		ConvolveScalar(x,taps,x2,taps2,m,y,padded);
+#endif
+
+		RecorderTrack* result = new RecorderTrack(offset+first+mn);
+		result->CopyFrom(y,offset+first,mn);
+
+		AlignedFree(y);
+		AlignedFree(x);
+		AlignedFree(taps);
+		return result;
+	}
+}
 
-void FloatBuffer::resizeArray(const unsigned int l) {
-  if ( l <= length ) return;
-	const float* old_data = data;
-	data = new float[l];
-	memcpy(data,old_data,length*sizeof(data[0]));
-	memset(data+length,0,(l-length)*sizeof(data[0]));
-	length = l;
-	delete[] old_data;
+float* FloatBuffer::allocatePage(const unsigned int p) {
+	if ( p >= pages.size() ) pages.resize(p+1,0);
+	if ( !pages[p] ) {
+		pages[p] = (float*) AlignedMalloc(FLOAT_BUFFER_PAGE_SIZE*sizeof(float));
+		memset(pages[p],0,FLOAT_BUFFER_PAGE_SIZE*sizeof(float));
+	}
+	return pages[p];
 }
 
-FloatBuffer::FloatBuffer() {
-	data = 0;
-	real_length = length = 0;
-	first_sample = INITIAL_BUFFER_SIZE -1;
-	this->resizeArray(INITIAL_BUFFER_SIZE);
+// Frees the pages from page p onwards
+void FloatBuffer::freePages(const unsigned int p) {
+	for ( unsigned int i = p; i < pages.size(); ++ i ) {
+		AlignedFree(pages[i]);
+	}
+	if ( p < pages.size() ) pages.resize(p);
+}
+
+FloatBuffer::FloatBuffer(unsigned int reserve) {
+	zero = 0.0f;
+	pages.reserve(((reserve ? reserve : INITIAL_BUFFER_SIZE) +
+		FLOAT_BUFFER_PAGE_SIZE - 1) / FLOAT_BUFFER_PAGE_SIZE);
+	real_length = 0;
+	first_sample = (unsigned int) -1;
 }
 FloatBuffer::~FloatBuffer() {
-	delete data;
+	freePages(0);
 }
 float& FloatBuffer::operator[] (const unsigned int i) {
-	if ( i >= length ) {
-		resizeArray(i+INCREMENTAL_BUFFER_SIZE);
-	}
+	const unsigned int p = i / FLOAT_BUFFER_PAGE_SIZE;
+	float* page = p < pages.size() ? pages[p] : 0;
+	if ( !page ) page = allocatePage(p);
 	if ( i > real_length ) real_length = i;
 	if ( i < first_sample ) first_sample = i;
-	return data[i];
+	return page[i % FLOAT_BUFFER_PAGE_SIZE];
 }
 const float& FloatBuffer::operator[] (const unsigned int i) const {
-	if ( i >= length ) {
+	const unsigned int p = i / FLOAT_BUFFER_PAGE_SIZE;
+	if ( p >= pages.size() || !pages[p] ) {
 		return zero;
 	}
-	return data[i];
+	return pages[p][i % FLOAT_BUFFER_PAGE_SIZE];
+}
+
+unsigned int FloatBuffer::Segment(unsigned int& i, unsigned int end, const float*& p) const {
+	for ( unsigned int q = i / FLOAT_BUFFER_PAGE_SIZE; i < end && q < pages.size();
+		i = ++ q * FLOAT_BUFFER_PAGE_SIZE ) {
+		if ( pages[q] ) {
+			p = pages[q] + i % FLOAT_BUFFER_PAGE_SIZE;
+			return (std::min)(end,(q+1) * FLOAT_BUFFER_PAGE_SIZE) - i;
+		}
+	}
+	return 0;
+}
+unsigned int FloatBuffer::Segment(unsigned int& i, unsigned int end, float*& p) {
+	const float* q;
+	const unsigned int n = static_cast<const FloatBuffer*>(this)->Segment(i,end,q);
+	p = const_cast<float*>(q);
+	return n;
+}
+
+unsigned int FloatBuffer::Extend(unsigned int i, unsigned int end, float*& p) {
+	if ( i >= end ) return 0;
+	const unsigned int n = (std::min)(end,(i / FLOAT_BUFFER_PAGE_SIZE + 1) * FLOAT_BUFFER_PAGE_SIZE) - i;
+	FloatBuffer& _this = *this;
+	_this[i+n-1];
+	p = &_this[i];
+	return n;
+}
+
+void FloatBuffer::CopyTo(float* x, unsigned int i, unsigned int n) const {
+	memset(x,0,n*sizeof(float));
+	const float* p;
+	for ( unsigned int j = i, m; (m = Segment(j,i+n,p)); j += m ) {
+		memcpy(x+j-i,p,m*sizeof(float));
+	}
+}
+
+void FloatBuffer::CopyFrom(const float* x, unsigned int i, unsigned int n) {
+	float* p;
+	for ( unsigned int j = 0, m; (m = Extend(i+j,i+n,p)); j += m ) {
+		memcpy(p,x+j,m*sizeof(float));
+	}
 }
 
 float FloatBuffer::RootMeanSquare() const {
 	if ( ! real_length ) return 0;
 	float x = 0.0;
-	for ( unsigned int i = first_sample; i < real_length; i ++ ) {
-		x += data[i]*data[i];
+	const float* p;
+	for ( unsigned int i = first_sample, n; (n = Segment(i,real_length,p)); i += n ) {
+		for ( unsigned int j = 0; j < n; ++ j ) {
+			x += p[j]*p[j];
+		}
 	}
 	return sqrt(x/(float)real_length);
 }
 
 float FloatBuffer::Maximum() const {
 	float x = 0.0;
-	for ( unsigned int i = first_sample; i < real_length; i ++ ) {
-		const float a = fabs(data[i]);
-		if ( a > x ) x = a;
+	const float* p;
+	for ( unsigned int i = first_sample, n; (n = Segment(i,real_length,p)); i += n ) {
+		for ( unsigned int j = 0; j < n; ++ j ) {
+			const float a = fabs(p[j]);
+			if ( a > x ) x = a;
+		}
 	}
 	return x;
 }
 
 void FloatBuffer::Multiply(float f) {
-	for ( unsigned int i = first_sample; i < real_length; i ++ ) {
-		data[i] *= f;
+	float* p;
+	for ( unsigned int i = first_sample, n; (n = Segment(i,real_length,p)); i += n ) {
+		for ( unsigned int j = 0; j < n; ++ j ) {
+			p[j] *= f;
+		}
 	}
 }
 
@@ -94,16 +343,18 @@ void FloatBuffer::Normalize(float M, float MAX) {
 
 void FloatBuffer::Truncate(unsigned int l) {
 	if ( l == 0 ) l = 1;
-	if ( l >= length ) {
-		resizeArray(l);
-	}
+	// The pages beyond the last sample are no longer needed
+	freePages(l / FLOAT_BUFFER_PAGE_SIZE + 1);
 	real_length = l;
 }
 
 void FloatBuffer::Power(float a) {
-	for ( unsigned int i = first_sample; i < real_length; i ++ ) {
-		const float f = pow(abs(data[i]),a);
-		data[i] = data[i] < 0 ? (f*-1.0f) : f;
+	float* p;
+	for ( unsigned int i = first_sample, n; (n = Segment(i,real_length,p)); i += n ) {
+		for ( unsigned int j = 0; j < n; ++ j ) {
+			const float f = pow(fabs(p[j]),a);
+			p[j] = p[j] < 0 ? (f*-1.0f) : f;
+		}
 	}
 }
 
@@ -111,15 +362,40 @@ unsigned int FloatBuffer::getLength(float tresh) const {
 	if ( tresh < 0.0f )
 		return real_length;
 	unsigned int max = 0;
-	for ( unsigned int i = first_sample; i < length; ++ i ) {
-		if ( abs(data[i]) >= tresh ) max = i;
+	const float* p;
+	for ( unsigned int i = first_sample, n; (n = Segment(i,real_length+1,p)); i += n ) {
+		for ( unsigned int j = 0; j < n; ++ j ) {
+			if ( fabs(p[j]) >= tresh ) max = i+j;
+		}
 	}
 	return max + 1;
 }
 
+namespace {
+	// Writes the samples of b from sample i up to sample end to f, including
+	// the zeros of the pages that have not been written to.
+	void WriteSamples(std::ostream& f, const FloatBuffer& b, unsigned int i, unsigned int end) {
+		std::vector<float> page(FLOAT_BUFFER_PAGE_SIZE);
+		for ( ; i < end; i += FLOAT_BUFFER_PAGE_SIZE ) {
+			const unsigned int n = (std::min)(end-i,(unsigned int)FLOAT_BUFFER_PAGE_SIZE);
+			b.CopyTo(&page[0],i,n);
+			f.write((const char*)&page[0],sizeof(float)*n);
+		}
+	}
+	// Reads the samples of b from sample i up to sample end from f
+	void ReadSamples(std::istream& f, FloatBuffer& b, unsigned int i, unsigned int end) {
+		std::vector<float> page(FLOAT_BUFFER_PAGE_SIZE);
+		for ( ; i < end; i += FLOAT_BUFFER_PAGE_SIZE ) {
+			const unsigned int n = (std::min)(end-i,(unsigned int)FLOAT_BUFFER_PAGE_SIZE);
+			f.read((char*)&page[0],sizeof(float)*n);
+			b.CopyFrom(&page[0],i,n);
+		}
+	}
+}
+
 void FloatBuffer::Write(const std::string& fn) const {
   std::ofstream f(fn.c_str(),std::ios_base::binary);
-	f.write((char*)data,sizeof(float)*(real_length+1));	
+	WriteSamples(f,*this,0,real_length+1);
 }
 
 void FloatBuffer::Read(const std::string& fn) {
@@ -127,13 +403,60 @@ void FloatBuffer::Read(const std::string& fn) {
 	f.seekg(0,std::ios_base::end);
   std::streamsize stream_size = f.tellg();
 	f.seekg(0,std::ios_base::beg);
-	resizeArray(stream_size/4);
-  f.read((char*)data,stream_size);
+	freePages(0);
+	ReadSamples(f,*this,0,stream_size/4);
   first_sample = 0;
   real_length = stream_size / 4;
 }
 
-#ifdef USE_FFTW
+void FloatBuffer::Write(std::ostream& f) const {
+	const unsigned int range[2] = {first_sample,real_length};
+	f.write((const char*)range,sizeof(range));
+	if ( first_sample <= real_length ) {
+		WriteSamples(f,*this,first_sample,real_length+1);
+	}
+}
+
+bool FloatBuffer::Read(std::istream& f) {
+	unsigned int range[2];
+	if ( !f.read((char*)range,sizeof(range)) ) return false;
+	freePages(0);
+	if ( range[0] <= range[1] ) {
+		ReadSamples(f,*this,range[0],range[1]+1);
+	}
+	first_sample = range[0];
+	real_length = range[1];
+	return f.good();
+}
+
+void FloatBuffer::Accumulate(const FloatBuffer& other) {
+	if ( other.first_sample > other.real_length ) return;
+	// Only the pages of other that have been written to are added. The pages
+	// of both buffers are aligned and hold the same range of samples, hence
+	// the samples in between the first and last whole cache lines of every
+	// segment are added using SIMD.
+	const float* b;
+	float* a;
+	for ( unsigned int i = other.first_sample, n; (n = other.Segment(i,other.real_length+1,b)); i += n ) {
+		Extend(i,i+n,a);
+		const unsigned int begin = (std::min)(((i + 15) & ~15u) - i,n);
+		const unsigned int end = (std::max)(((i + n) & ~15u) - i,begin);
+		unsigned int j = 0;
+		for ( ; j < begin; ++ j ) {
+			a[j] += b[j];
+		}
+		AddSamples(a+begin,b+begin,end-begin);
+		for ( j = end; j < n; ++ j ) {
+			a[j] += b[j];
+		}
+	}
+	// Extends the range of the buffer to include the range of other
+	if ( other.first_sample < first_sample ) first_sample = other.first_sample;
+	if ( other.real_length > real_length ) real_length = other.real_length;
+}
+
+bool RecorderTrack::direct_convolution = false;
+
 // Processes a sound file to include the response in the recorder
 // track. The response is not interpolated with a successive
 // response. A Fast Fourier Transform is used to transfer both the
@@ -142,80 +465,113 @@ void FloatBuffer::Read(const std::string& fn) {
 // An additional argument specifies whether to optionally fade in
 // or fade out the input signal to help with the interpolation
 // of successive key-frames.
+// The convolution is uniformly partitioned: the impulse response is
+// divided into P blocks of B samples of which the spectra are
+// calculated once. The dry signal is transformed block by block, the
+// spectra of the last P blocks are kept in a frequency-domain delay
+// line. Every block of output is the inverse transform of the sum of
+// the products of the spectra of the delay line and the impulse
+// response, which is overlap-added to the result. The memory used
+// therefore only depends on the length of the impulse response, not
+// on the length of the sound file.
 RecorderTrack* RecorderTrack::Process(SoundFile* const sound_file,
                                       Fade fade) const {
 
-	const RecorderTrack& _this = *this;
 	const unsigned int M = this->getLength();
 	const unsigned int N = sound_file->sample_length;
-	const unsigned int MN = M+N+1;
-	const unsigned int MNh = MN/2+1;
-
-	float* a = (float*) fftwf_malloc(sizeof (float) * MN);	
-	memset(a,0,sizeof(float)*MN);
-	memcpy(a,&_this[0],sizeof(float)*M);
-
-	fftwf_complex* A = (fftwf_complex *) fftwf_malloc (
-		sizeof (fftwf_complex) * MNh);
-	memset(A,0,sizeof (fftwf_complex) * MNh);
-	fftwf_plan fft_plan1 = fftwf_plan_dft_r2c_1d(
-		MN,a,A,FFTW_ESTIMATE);
-	fftwf_execute(fft_plan1);
-	fftwf_free(a);
-
-	float* b = (float*) fftwf_malloc(sizeof (float) * MN);
-	memset(b,0,sizeof(float)*MN);
-	memcpy(b,sound_file->data,sizeof(float)*N);
-	if ( fade != CONSTANT ) {
-		float factor = fade == FADE_OUT ? 1.0f : 0.0f;
-		float df = (fade == FADE_OUT ? -1.0f : 1.0f) /
-			(float)sound_file->sample_length;
-		for ( unsigned int i = 0;
-			i < sound_file->sample_length;
-			++ i ) {
-				b[i] *= factor;
-				factor += df;
-		}
-	}
-	fftwf_complex* B = (fftwf_complex *) fftwf_malloc (
-		sizeof (fftwf_complex) * MNh);
-	memset(B,0,sizeof (fftwf_complex) * MNh);
-	fftwf_plan fft_plan2 = fftwf_plan_dft_r2c_1d(
-		MN,b,B,FFTW_ESTIMATE);	
-	fftwf_execute(fft_plan2);
-	fftwf_free(b);
-
-	float scale = 1.0f / (float)MN;
-	for ( unsigned int i = 0; i < MNh; ++ i ) {
-		float re = (A[i][0] * B[i][0] - A[i][1] * B[i][1]) * scale;
-		float im = (A[i][0] * B[i][1] + A[i][1] * B[i][0]) * scale;
-		A[i][0] = re;
-		A[i][1] = im;
+	if ( !M || !N ) return new RecorderTrack();
+	const unsigned int MN = M+N-1;
+
+	// The blocks are a power of two, which is transformed efficiently,
+	// of at least the length of the impulse response, but no larger than
+	// MAX_PARTITION_SIZE, in which case the response is partitioned.
+	unsigned int B = MIN_PARTITION_SIZE;
+	while ( B < M && B < MAX_PARTITION_SIZE ) B *= 2;
+	const unsigned int L = 2*B;
+	const unsigned int Lh = B+1;
+	// The spectra of successive blocks are stored an even number of complex
+	// values apart, so that every spectrum is as aligned as the arrays the
+	// transforms are planned for, which fftw requires.
+	const unsigned int S = (Lh+1)&~1u;
+	const unsigned int P = (M+B-1)/B;
+	const FFTPlan& plan = FFTPlans::Get(L);
+
+	float* block = (float*) FFTMalloc(sizeof (float) * L);
+	float* work = (float*) FFTMalloc(sizeof (float) * (plan.workSize()+1));
+
+	// The spectra of the partitions of the impulse response
+	FFTComplex* H = (FFTComplex *) FFTMalloc (
+		sizeof (FFTComplex) * S * P);
+	for ( unsigned int p = 0; p < P; ++ p ) {
+		const unsigned int n = (std::min)(B,M-p*B);
+		memset(block,0,sizeof(float)*L);
+		CopyTo(block,p*B,n);
+		plan.Forward(block,H+p*S,work);
 	}
 
-	fftwf_free(B);
-
-	float* c = (float*) fftwf_malloc(sizeof (float) * MN);
-	memset(c,0,sizeof(float)*MN);
-	fftwf_plan inv_fft_plan = fftwf_plan_dft_c2r_1d(
-		MN,A,c,FFTW_ESTIMATE);
-
-	fftwf_execute(inv_fft_plan);
-
-	fftwf_free(A);
-
-	RecorderTrack* result = new RecorderTrack();
-	RecorderTrack& _result = *result;
+	// The frequency-domain delay line of the spectra of the last P blocks
+	// of the dry signal, stored circularly.
+	FFTComplex* X = (FFTComplex *) FFTMalloc (
+		sizeof (FFTComplex) * S * P);
+	FFTComplex* Y = (FFTComplex *) FFTMalloc (
+		sizeof (FFTComplex) * Lh);
+
+	const unsigned int offset = sound_file->offset;
+	// The pages and the range of the result are extended as the blocks of
+	// output are added, the last block ends at the last sample
+	RecorderTrack* result = new RecorderTrack(offset+MN);
+
+	const float scale = 1.0f / (float)L;
+	const float df = fade == CONSTANT ? 0.0f :
+		(fade == FADE_OUT ? -1.0f : 1.0f) / (float)N;
+	const float f0 = fade == FADE_IN ? 0.0f : 1.0f;
+
+	// The dry signal blocks, followed by the blocks to flush the delay line
+	const unsigned int input_blocks = (N+B-1)/B;
+	const unsigned int output_blocks = (MN+B-1)/B;
+	for ( unsigned int k = 0; k < output_blocks; ++ k ) {
+		if ( k < input_blocks ) {
+			const unsigned int start = k*B;
+			const unsigned int n = (std::min)(B,N-start);
+			memset(block,0,sizeof(float)*L);
+			for ( unsigned int i = 0; i < n; ++ i ) {
+				block[i] = sound_file->data[start+i] *
+					(f0 + df * (float)(start+i));
+			}
+			plan.Forward(block,X+(k%P)*S,work);
+		}
 
-	for ( unsigned int i = 0; i < MN; ++ i ) {
-		_result[i+sound_file->offset] = c[i];
+		// Only the blocks of the dry signal that are still in the delay line
+		// contribute to this block of output
+		memset(Y,0,sizeof(FFTComplex)*Lh);
+		const unsigned int first = k+1 > P ? k+1-P : 0;
+		const unsigned int last = (std::min)(k,input_blocks-1);
+		for ( unsigned int j = first; j <= last; ++ j ) {
+			const FFTComplex* h = H+(k-j)*S;
+			const FFTComplex* x = X+(j%P)*S;
+			for ( unsigned int i = 0; i < Lh; ++ i ) {
+				Y[i][0] += h[i][0] * x[i][0] - h[i][1] * x[i][1];
+				Y[i][1] += h[i][0] * x[i][1] + h[i][1] * x[i][0];
+			}
+		}
+		plan.Inverse(Y,block,work);
+
+		// The block is added a page at a time rather than for every sample
+		const unsigned int start = offset+k*B;
+		const unsigned int n = (std::min)(L,MN-k*B);
+		float* p;
+		for ( unsigned int j = 0, m; (m = result->Extend(start+j,start+n,p)); j += m ) {
+			for ( unsigned int i = 0; i < m; ++ i ) {
+				p[i] += block[j+i] * scale;
+			}
+		}
 	}
 
-	fftwf_free(c);
-
-	fftwf_destroy_plan (fft_plan1);
-	fftwf_destroy_plan (fft_plan2);
-	fftwf_destroy_plan (inv_fft_plan);	
+	FFTFree(block);
+	FFTFree(work);
+	FFTFree(H);
+	FFTFree(X);
+	FFTFree(Y);
 
 	return result;
 }
@@ -241,62 +597,55 @@ RecorderTrack* RecorderTrack::Process(RecorderTrack* const other,
 	delete b;
 	return a;
 }
-#else
+
 // Processes a sound file to include the response in the recorder
 // track. The response is not interpolated with a successive response
-RecorderTrack* RecorderTrack::Process(SoundFile* const sound_file)
-                                      const {
-	RecorderTrack* result = new RecorderTrack();
-	RecorderTrack& _result = *result;
-	const RecorderTrack& _this = *this;
-	const unsigned int len = this->real_length;
-	const unsigned int sound_length = sound_file->sample_length;
-	for ( unsigned int i = 0; i < sound_length; ++ i ) {
-		const float sfs = sound_file->data[i];
-		int index = i + sound_file->offset + first_sample;
-		for ( unsigned int j = first_sample; j < len; ++ j ) {
-			_result[index++] += sfs * _this[j];
-		}
-		DrawProgressBar(i,sound_length);
-	}
-	return result;
+RecorderTrack* RecorderTrack::ProcessDirect(SoundFile* const sound_file)
+                                            const {
+	const unsigned int m = real_length > first_sample ? real_length - first_sample : 0;
+	return Convolve(sound_file->data,sound_file->sample_length,sound_file->offset,
+		this,0,first_sample,m,1.0f,0.0f);
 }
 // Processes a sound file to include the response in the recorder
 // track. The response is interpolated with another response to
-// suggest the perception of movement from one location to the other
-RecorderTrack* RecorderTrack::Process(RecorderTrack* const other,
-                                      SoundFile* const sound_file)
-                                      const {
-	RecorderTrack* result = new RecorderTrack();
-	RecorderTrack& _result = *result;
-	const RecorderTrack& _this = *this;
-	const RecorderTrack& _other = *other;
+// suggest the perception of movement from one location to the other.
+// The interpolated response weighs the responses by the index of the
+// sample of the sound file it is convolved with, hence this equals the
+// sum of the convolutions of the responses with the sound file faded out
+// and faded in respectively.
+RecorderTrack* RecorderTrack::ProcessDirect(RecorderTrack* const other,
+                                            SoundFile* const sound_file)
+                                            const {
 	const unsigned int sound_length = sound_file->sample_length;
 	const float flt_samples = 1.0f / (float) sound_length;
 	const unsigned int len = (std::max)(
 		real_length,other->real_length);
 	const unsigned int first = (std::min)(
 		first_sample,other->first_sample);
-	for( unsigned int i = 0; i < sound_length; i ++ ) {
-		const float i1 = i * flt_samples;
-		const float i2 = 1.0f - i1;
-		const float sfs = sound_file->data[i];
-		int index = i + sound_file->offset + first;
-		for ( unsigned int j = first; j < len; j ++ ) {
-			const float p = i2 * _this[j] + i1 * _other[j];
-			_result[index++] += sfs * p;
-		}
-		DrawProgressBar(i,sound_length);
-	}
-	return result;
+	const unsigned int m = len > first ? len - first : 0;
+	return Convolve(sound_file->data,sound_length,sound_file->offset,
+		this,other,first,m,1.0f,-flt_samples);
 }
-#endif
+
 void RecorderTrack::Add(const RecorderTrack* other) {
-	FloatBuffer& _this = *this;
-	const RecorderTrack& _other = *other;
-	const unsigned int len = other->getLength(0.0f);
-	for ( unsigned int i = 0; i < len; ++ i ) {
-		_this[i] += _other[i];
+	// Only the samples that have been written are added, so that the length
+	// of the result does not depend on the size allocated for other.
+	Accumulate(*other);
+}
+
+void RecorderTrack::Splat(int s, int w, float ampl, float step) {
+	int i = 0;
+	for ( ; i < w && i + s < 0; ++ i ) {
+		ampl -= step;
+	}
+	if ( i >= w ) return;
+	// The range is extended once for every page, rather than for every sample
+	float* p;
+	for ( unsigned int j = s+i, n; (n = Extend(j,s+w,p)); j += n ) {
+		for ( unsigned int k = 0; k < n; ++ k ) {
+			p[k] += ampl;
+			ampl -= step;
+		}
 	}
 }
 
@@ -343,7 +692,11 @@ float RecorderTrack::T60() const {
 void Recorder::Process(SoundFile* const sf, float offset) {
 	for ( TrackIt it = tracks.begin(); it != tracks.end(); ++ it ) {
 		SoundFile* section = sf->Section(offset);
-		processed_tracks.push_back((*it)->Process(section));
+		const bool direct = RecorderTrack::direct_convolution ||
+			(*it)->getLength() <= MAX_DIRECT_CONVOLUTION_LENGTH;
+		processed_tracks.push_back(direct
+			? (*it)->ProcessDirect(section)
+			: (*it)->Process(section));
 		delete section;
 	}
 	is_processed = true;
@@ -355,8 +708,11 @@ void Recorder::Process(SoundFile* const sf, Recorder* r,
 	for ( TrackIt it = tracks.begin();
 		it != tracks.end(); ++ it, ++ track_id ) {
 		SoundFile* section = sf->Section(offset,length);
-		processed_tracks.push_back(
-			(*it)->Process(r->tracks[track_id],section));
+		const bool direct = RecorderTrack::direct_convolution ||
+			(std::max)((*it)->getLength(),r->tracks[track_id]->getLength()) <= MAX_DIRECT_CONVOLUTION_LENGTH;
+		processed_tracks.push_back(direct
+			? (*it)->ProcessDirect(r->tracks[track_id],section)
+			: (*it)->Process(r->tracks[track_id],section));
 		delete section;
 	}
 	is_processed = true;
@@ -403,10 +759,9 @@ void Recorder::Truncate(int len) {
 	}
 }
 
-const float* Recorder::getSamples(unsigned int channel) {
-	if ( channel >= tracks.size() ) return 0;
-	const RecorderTrack& track = *tracks[channel];
-	return &track[0];
+void Recorder::getSamples(float* x, unsigned int channel) {
+	if ( channel >= tracks.size() ) return;
+	tracks[channel]->CopyTo(x,0,getLength());
 }
 
 unsigned int Recorder::getLength(float tresh) {
@@ -440,6 +795,14 @@ void Recorder::Add(Recorder* r) {
 	is_processed = true;
 }
 
+void Recorder::Accumulate(Recorder* r) {
+	if ( trackCount() != r->trackCount() ) throw std::runtime_error("Recorders do not match");
+	for ( unsigned int i = 0; i < tracks.size(); ++ i ) {
+		tracks[i]->Accumulate(*r->tracks[i]);
+	}
+	has_samples = has_samples || r->has_samples;
+}
+
 void Recorder::Normalize(float M) {
 	float max = -1e9;
 	TrackIt begin,end;
@@ -459,6 +822,33 @@ void Recorder::Normalize(float M) {
 	}
 }
 
+void Recorder::Record(const gmtl::Vec3f& dir, float ampl, float t, float dist, int band, int kf) {
+	Contribution c;
+	c.sample = (unsigned int) (t*SAMPLE_RATE);
+	c.t = t;
+	c.ampl = ampl;
+	c.dist = dist;
+	c.dir = dir;
+	c.band = band;
+	c.kf = kf;
+	contributions.push_back(c);
+	if ( contributions.size() >= CONTRIBUTION_LOG_SIZE ) Flush();
+}
+
+void Recorder::Flush(bool release) {
+	if ( !contributions.empty() ) {
+		SortContributions(contributions,sorted_contributions);
+		for ( std::vector<Contribution>::const_iterator it = contributions.begin(); it != contributions.end(); ++ it ) {
+			Splat(*it);
+		}
+		contributions.clear();
+	}
+	if ( release ) {
+		std::vector<Contribution>().swap(contributions);
+		std::vector<Contribution>().swap(sorted_contributions);
+	}
+}
+
 Recorder::~Recorder() {
 	for ( TrackIt it = processed_tracks.begin();
 		it != processed_tracks.end(); ++ it ) {
@@ -21,6 +21,7 @@
 #define RECORDER_H
 
 #include <vector>
+#include <iostream>
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
@@ -33,38 +34,70 @@
 #include "SoundFile.h"
 
 #define SAMPLE_RATE (44100)
-#define INITIAL_BUFFER_SIZE (3*SAMPLE_RATE)
-#define INCREMENTAL_BUFFER_SIZE (1*SAMPLE_RATE)
-
-/// Whether to use fftw to process the convolution in the frequency domain
-// #define USE_FFTW
-
-#ifdef USE_FFTW
-#ifdef _MSC_VER
-#define FFTW_DLL
-#endif
-#include <fftw3.h>
-#endif
+/// The number of samples of the pages in which buffers store their samples,
+/// a power of two. Pages are only allocated once a sample in them is written.
+#define FLOAT_BUFFER_PAGE_SIZE (4096)
+/// The number of samples for which a buffer that is not given the number
+/// of samples it is expected to hold reserves room in its table of pages.
+#define INITIAL_BUFFER_SIZE (SAMPLE_RATE/4)
+/// The range of the size of the blocks in which the impulse response is
+/// partitioned for convolution in the frequency domain
+#define MIN_PARTITION_SIZE (4096)
+#define MAX_PARTITION_SIZE (65536)
+/// Impulse responses of up to this number of samples are convoluted in the
+/// time domain, for which the blocked kernel is faster than the transforms
+#define MAX_DIRECT_CONVOLUTION_LENGTH (256)
+/// The number of contributions a recorder logs before they are added to its
+/// tracks, see Recorder::Flush(). Every recorder of every chunk in flight has
+/// its own log, hence it is kept small enough to stay in the L2 cache.
+#define CONTRIBUTION_LOG_SIZE (4096)
 
 /// This class behaves as a dynamic array of floating point numbers.
 /// NOTE: The behaviour of this class differs whether it is a constant
 /// or non-constant copy. In case of a non-constant instance, the
-/// element access operater automatically resizes the array in case
-/// of accessing an element outside of the array bounds, whereas a constant
-/// instance in that case would simply return 0.0.
+/// element access operater automatically allocates the page of
+/// FLOAT_BUFFER_PAGE_SIZE samples in which an element is stored in case
+/// it has not been written to before, whereas a constant instance in that
+/// case would simply return 0.0. Hence, a response that only has samples
+/// from some point onwards, or has gaps, does not occupy memory for the
+/// samples in between. Pages are aligned to 64 bytes, so that they can be
+/// processed using SIMD. Use Segment() to iterate over the samples that
+/// are stored.
 class FloatBuffer {
 private:
 	float zero;
-	float* data;
-	unsigned int length;
-	void resizeArray(const unsigned int l);
+	std::vector<float*> pages;
+	float* allocatePage(const unsigned int p);
+	void freePages(const unsigned int p);
 public:
 	unsigned int first_sample;
 	unsigned int real_length;
-	FloatBuffer();
+	/// Creates an empty buffer with room in its table of pages for the
+	/// number of samples in reserve, or INITIAL_BUFFER_SIZE samples in case
+	/// it is zero. No pages are allocated yet.
+	FloatBuffer(unsigned int reserve = 0);
 	~FloatBuffer();
 	float& operator[] (const unsigned int i);
 	const float& operator[] (const unsigned int i) const;
+	/// Sets p to the samples that are stored contiguously from sample i
+	/// onwards, up to the end of the page or sample end, and returns their
+	/// number. Pages that have not been written to are skipped, in which
+	/// case i is moved to the start of the next page that has been. Returns
+	/// zero in case there are no stored samples left before end. Iterate as:
+	///     for ( i = first; (n = Segment(i,end,p)); i += n ) { ... }
+	unsigned int Segment(unsigned int& i, unsigned int end, const float*& p) const;
+	unsigned int Segment(unsigned int& i, unsigned int end, float*& p);
+	/// Sets p to the samples that are stored contiguously from sample i
+	/// onwards, up to the end of the page or sample end, and returns their
+	/// number. Contrary to Segment(), the page is allocated if necessary
+	/// and the range of the buffer is extended to include these samples.
+	unsigned int Extend(unsigned int i, unsigned int end, float*& p);
+	/// Copies the n samples from sample i onwards into x, which is how the
+	/// samples are passed to code that needs them contiguously, such as the
+	/// input of the convolution.
+	void CopyTo(float* x, unsigned int i, unsigned int n) const;
+	/// Copies the n samples in x into the buffer from sample i onwards.
+	void CopyFrom(const float* x, unsigned int i, unsigned int n);
 	/// Returns the Root Mean Square (or quadratic mean) of the
 	/// data in the array. Any leading or trailing zero's are not
 	/// included in the calculation.
@@ -78,7 +111,8 @@ public:
 	/// defines the original value that gets mapped to the value in
 	/// the first parameter.
 	void Normalize(float M = 1.0f, float MAX = -1.0f);
-	/// Truncates (or matches) the buffer to this length.
+	/// Truncates (or matches) the buffer to this length. The pages beyond
+	/// this length are freed.
 	void Truncate(unsigned int l);
 	/// Raises the data in the buffer to the power specified in a. The
 	/// default of 0.67 is attributed to Stevens' power law:
@@ -89,6 +123,15 @@ public:
 	unsigned int getLength(float tresh = -1.0f) const;
 	void Write(const std::string& fn) const;
 	void Read(const std::string& fn);
+	/// Writes the data in the buffer to a binary stream, preceded by a header
+	/// with the range of samples that are written, so that the buffer can be
+	/// restored exactly by Read().
+	void Write(std::ostream& f) const;
+	/// Replaces the data in the buffer by the data written to the stream by
+	/// Write(). Returns false in case the stream does not contain a buffer.
+	bool Read(std::istream& f);
+	/// Adds the samples in other to the samples in the buffer.
+	void Accumulate(const FloatBuffer& other);
 };
 
 /// This class represents a single impulse response of a listener. The main
@@ -96,7 +139,12 @@ public:
 /// impulse response.
 class RecorderTrack : public FloatBuffer {
 public:
-#ifdef USE_FFTW
+	/// Whether sound files are convoluted in the time domain by
+	/// ProcessDirect() rather than in the frequency domain by Process().
+	/// Regardless, responses of at most MAX_DIRECT_CONVOLUTION_LENGTH samples
+	/// are convoluted in the time domain.
+	static bool direct_convolution;
+	RecorderTrack(unsigned int reserve = 0) : FloatBuffer(reserve) {}
 	typedef enum { CONSTANT, FADE_IN, FADE_OUT } Fade;
 	/// Processes a sound file to include the response in the recorder track.
 	/// The response is not interpolated with a successive response.
@@ -118,17 +166,21 @@ public:
 	/// hence the dry signal is faded in and out respectively before
 	/// convolution occurs with the impulse response.
 	RecorderTrack* Process(RecorderTrack* const other, SoundFile* const sound_file) const;
-#else
-	/// Processes a sound file to include the response in the recorder track.
-	/// The response is not interpolated with a successive response.
-	RecorderTrack* Process(SoundFile* const sound_file) const;
-	/// Processes a sound file to include the response in the recorder track.
-	/// The response is interpolated with another response to suggest the
-	/// perception of movement from one location to the other.
-	RecorderTrack* Process(RecorderTrack* const other, SoundFile* const sound_file) const;
-#endif
+	/// Processes a sound file to include the response in the recorder track
+	/// by convolution in the time domain. The response is not interpolated
+	/// with a successive response.
+	RecorderTrack* ProcessDirect(SoundFile* const sound_file) const;
+	/// Processes a sound file to include the response in the recorder track
+	/// by convolution in the time domain. The response is interpolated
+	/// linearly with another response to suggest the perception of movement
+	/// from one location to the other.
+	RecorderTrack* ProcessDirect(RecorderTrack* const other, SoundFile* const sound_file) const;
 	/// Linearly adds the data from the other recorder track to this one.
 	void Add(const RecorderTrack* other);
+	/// Adds w samples from sample s onwards, the first of which is ampl and
+	/// every next one step less, which is the filter used by the recorders
+	/// to splat their samples. Samples before the start are skipped.
+	void Splat(int s, int w, float ampl, float step);
 	/// Returns the T60 reverberation time for the samples stored in this recorder track.
 	/// From http://en.wikipedia.org/wiki/Reverberation
 	/// T60 is the time required for reflections of a direct sound to decay by 60 dB below
@@ -139,6 +191,20 @@ public:
 	/// could for example implement the IACC (Inter Aural Cross Correlation).
 };
 
+/// A contribution of a path to the impulse response of a recorder, with the
+/// arguments passed to Recorder::Record().
+struct Contribution {
+	/// The sample at which the contribution arrives, by which the log of
+	/// contributions is sorted
+	unsigned int sample;
+	float t;
+	float ampl;
+	float dist;
+	gmtl::Vec3f dir;
+	int band;
+	int kf;
+};
+
 /// This class is the abstract base class for all classes of listeners. It defines
 /// methods to record rendered samples and to use the data in the recorder for
 /// convoluting sound files to include the rendered response in the final result.
@@ -162,8 +228,10 @@ public:
 	virtual void setLocation(gmtl::Point3f& loc) = 0;
 	/// Returns the filename of to where the final result will be written.
 	virtual std::string getFilename() = 0;
-	/// Gets a blank copy of a recorder with the same amount of tracks.
-	virtual Recorder* getBlankCopy(int secs = -1) = 0;
+	/// Gets a blank copy of a recorder with the same amount of tracks. The
+	/// tracks reserve room for the number of samples in reserve in case it
+	/// is not zero, see Scene::ResponseLength().
+	virtual Recorder* getBlankCopy(unsigned int reserve = 0) = 0;
 	/// Returns the animated location of the recorder in case it is defined.
 	virtual Animated<gmtl::Point3f>* getAnimationData() = 0;
 	/// Returns whether the recorder is animated.
@@ -174,7 +242,16 @@ public:
 	/// sample divided by the speed of sound. The distance is used to splat the sample over
 	/// the buffer using a filter. The band is used to incorporate properties that differ per
 	/// frequency, such as the filter or potentially the HRTF.
-	virtual void Record(const gmtl::Vec3f& dir, float ampl, float t, float dist, int band, int kf) = 0;
+	/// The samples are logged and only added to the tracks by Flush(), which
+	/// happens once CONTRIBUTION_LOG_SIZE samples are logged.
+	void Record(const gmtl::Vec3f& dir, float ampl, float t, float dist, int band, int kf);
+	/// Adds the logged samples to the tracks. The log is sorted by arrival
+	/// time first, so that the tracks are written in a single pass from
+	/// front to back rather than at random offsets. Needs to be called
+	/// before the tracks are used after samples have been recorded. In case
+	/// release is set, the memory of the log is freed as well, which is done
+	/// once a recorder is done recording.
+	void Flush(bool release = false);
 	/// Saves the data in the recorder to the specified filename. In case the the recorder contains
 	/// processed data, the member save_processed dictates whether the convoluted sound file
 	/// or the raw impulse resonse is written to file.
@@ -206,18 +283,27 @@ public:
 	void Truncate(Recorder* r2, Recorder* r3);
 	/// Truncates (or matches) the tracks in the recorder to this length.
 	void Truncate(int len);
-	/// Returns a const float array of the one of the tracks in the recorder.
-	/// Use getLength() to determine the length of the returned array.
-	const float* getSamples(unsigned int channel = 0);
+	/// Copies the samples of one of the tracks in the recorder into x. Use
+	/// getLength() to determine the number of samples that are copied.
+	void getSamples(float* x, unsigned int channel = 0);
 	/// Returns maximum length of all tracks in this recorder incorporating
 	/// a treshold that signals values under this treshold to be neglected.
 	unsigned int getLength(float tresh = -1.0f);
 	/// Linearly adds the tracks from the other recorder to this one.
 	void Add(Recorder* r);
+	/// Linearly adds the unprocessed tracks, i.e. the impulse responses,
+	/// from the other recorder to this one.
+	void Accumulate(Recorder* r);
 	/// Normalizes the tracks in this recorder. The parameter defines
 	/// the resulting maximum value in the buffers.
 	void Normalize(float M = 1.0f);
 	~Recorder();
+protected:
+	/// Splats a logged sample over the tracks using a filter, see Record()
+	virtual void Splat(const Contribution& c) = 0;
+private:
+	std::vector<Contribution> contributions;
+	std::vector<Contribution> sorted_contributions;
 };
 
 #endif
\ No newline at end of file
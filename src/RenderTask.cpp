@@ -0,0 +1,174 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <algorithm>
+
+#include "Scene.h"
+#include "Convergence.h"
+#include "Checkpoint.h"
+#include "HelperFunctions.h"
+#include "SceneContext.h"
+#include "RenderTask.h"
+
+RenderTask::RenderTask(SceneContext* c) :
+		context(c), first_sample(0), traced(0), reduced(0), reducing(false), stopped(false), finished(false),
+		convergence(0), last_checkpoint(time(0)) {
+	Scene* scene = context->scene;
+
+	// A resumed render continues with the paths after the ones stored in
+	// the checkpoint.
+	if ( !scene->checkpoint_dir.empty() ) {
+		checkpoint_file = Checkpoint::Filename(scene->checkpoint_dir,
+			context->soundfile_id,context->band,context->keyframe_id);
+		if ( scene->resume ) {
+			Checkpoint::Load(checkpoint_file,context->seed,first_sample,context->recorders);
+		}
+	}
+	traced = first_sample;
+
+	batch = scene->BatchSize(context->samples);
+	chunks = (std::max)(0,(context->samples - first_sample + batch - 1) / batch);
+	results.resize(chunks);
+	convergences.resize(chunks,(Convergence*)0);
+	if ( scene->target_error > 0.0f ) {
+		convergence = new Convergence(batch,scene->target_error);
+	}
+
+	// A render that was already finished by the checkpoint is completed
+	// right away.
+	if ( !chunks ) Finish();
+}
+
+void RenderTask::Trace(int chunk, int worker) {
+	{boost::mutex::scoped_lock lock(mutex);
+	if ( stopped ) {
+		AdvanceProgressBar();
+		return;
+	}}
+
+	const int start = first_sample + chunk * batch;
+	const int end = (std::min)(start + batch,context->samples);
+	std::vector<Recorder*> recs;
+	for ( std::vector<Recorder*>::const_iterator it = context->recorders.begin(); it != context->recorders.end(); ++ it ) {
+		recs.push_back((*it)->getBlankCopy(context->scene->ResponseLength()));
+	}
+	Convergence* c = convergence ? new Convergence(batch,context->scene->target_error) : 0;
+
+	context->scene->Trace(context->band,context->soundfile_id,context->absorption,
+		start,end,recs,context->keyframe_id,context->seed,c);
+
+	// The chunk is added by the worker that is adding chunks already, in
+	// case there is one, or otherwise by this worker.
+	{boost::mutex::scoped_lock lock(mutex);
+	if ( stopped ) {
+		for ( unsigned int i = 0; i < recs.size(); ++ i ) {
+			delete recs[i];
+		}
+		delete c;
+	} else {
+		results[chunk] = recs;
+		convergences[chunk] = c;
+	}
+	if ( stopped || reducing ) {
+		AdvanceProgressBar();
+		return;
+	}
+	reducing = true;}
+
+	Reduce();
+	AdvanceProgressBar();
+}
+
+void RenderTask::Reduce() {
+	Scene* scene = context->scene;
+	while ( true ) {
+		std::vector<Recorder*> recs;
+		Convergence* c;
+		{boost::mutex::scoped_lock lock(mutex);
+		if ( stopped || reduced == chunks || results[reduced].empty() ) {
+			reducing = false;
+			if ( !stopped && reduced < chunks ) return;
+			// The remaining chunks are discarded once stopped is set
+			stopped = true;
+			break;
+		}
+		recs.swap(results[reduced]);
+		c = convergences[reduced];
+		convergences[reduced] = 0;}
+
+		for ( unsigned int i = 0; i < recs.size(); ++ i ) {
+			context->recorders[i]->Accumulate(recs[i]);
+			delete recs[i];
+		}
+		const int next = reduced + 1;
+		traced = (std::min)(first_sample + next * batch,context->samples);
+
+		bool converged = false;
+		if ( convergence ) {
+			convergence->Merge(*c);
+			delete c;
+			converged = traced < context->samples && convergence->EndBatch();
+		}
+
+		{boost::mutex::scoped_lock lock(mutex);
+		reduced = next;
+		if ( converged ) stopped = true;}
+
+		if ( !checkpoint_file.empty() ) {
+			const time_t now = time(0);
+			if ( converged || next == chunks ||
+				difftime(now,last_checkpoint) >= scene->checkpoint_interval ) {
+				Checkpoint::Save(checkpoint_file,context->seed,traced,context->recorders);
+				last_checkpoint = now;
+			}
+		}
+	}
+	Finish();
+}
+
+void RenderTask::Finish() {
+	// Chunks that finish after the impulse response has converged are
+	// discarded.
+	{boost::mutex::scoped_lock lock(mutex);
+	for ( int i = reduced; i < chunks; ++ i ) {
+		for ( unsigned int j = 0; j < results[i].size(); ++ j ) {
+			delete results[i][j];
+		}
+		results[i].clear();
+		delete convergences[i];
+		convergences[i] = 0;
+	}}
+	if ( finished ) return;
+	finished = true;
+
+	context->scene->Finish(context->band,context->soundfile_id,context->absorption,
+		traced,context->dry_level,context->recorders,context->keyframe_id);
+	context->samples_traced = traced;
+	if ( convergence ) context->error = convergence->getError();
+}
+
+RenderTask::~RenderTask() {
+	for ( int i = 0; i < chunks; ++ i ) {
+		for ( unsigned int j = 0; j < results[i].size(); ++ j ) {
+			delete results[i][j];
+		}
+		delete convergences[i];
+	}
+	delete convergence;
+}
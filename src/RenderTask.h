@@ -0,0 +1,82 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef RENDERTASK_H
+#define RENDERTASK_H
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include <boost/thread/mutex.hpp>
+
+class SceneContext;
+class Recorder;
+class Convergence;
+
+/// Divides the paths of the impulse response of a SceneContext into chunks
+/// of Scene::BatchSize() paths, that are traced as separate tasks of a
+/// ThreadPool, so that all threads contribute to the impulse response
+/// regardless of the number of contexts. Every chunk is recorded into its
+/// own blank copies of the recorders of the context. The chunks are added
+/// to the context in the order of the paths, which makes the result
+/// independent of the number of threads and of the order in which the
+/// chunks are executed. In between chunks the convergence is tested and
+/// checkpoints are written, see Scene::target_error and Checkpoint.
+/// The chunks are added by one worker at a time, outside of the lock that
+/// guards the finished chunks, so that the other workers never wait for
+/// the additions or the checkpoints and continue with the next chunk.
+class RenderTask {
+private:
+	SceneContext* context;
+	int first_sample;
+	int traced;
+	int batch;
+	int chunks;
+	int reduced;
+	bool reducing;
+	bool stopped;
+	bool finished;
+	Convergence* convergence;
+	std::string checkpoint_file;
+	time_t last_checkpoint;
+	std::vector<std::vector<Recorder*> > results;
+	std::vector<Convergence*> convergences;
+	boost::mutex mutex;
+	/// Adds the finished chunks that follow the chunks already added to
+	/// the context and completes the context once all chunks are added or
+	/// the impulse response has converged. Only called by the worker that
+	/// set reducing.
+	void Reduce();
+	void Finish();
+	RenderTask(const RenderTask&);
+	RenderTask& operator=(const RenderTask&);
+public:
+	/// Prepares the render of context, which continues from its checkpoint
+	/// in case the scene is resumed.
+	RenderTask(SceneContext* context);
+	/// The number of chunks that remain to be traced
+	int chunkCount() const { return chunks; }
+	/// Traces the paths of chunk, worker is the index of the thread that
+	/// executes the chunk, see ThreadPool::Task.
+	void Trace(int chunk, int worker);
+	~RenderTask();
+};
+
+#endif
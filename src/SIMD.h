@@ -0,0 +1,119 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX__
+#define SIMD_AVX
+#include <immintrin.h>
+#endif
+
+#ifdef __FMA__
+#define SIMD_FMA
+#include <immintrin.h>
+#endif
+
+// Thin wrappers around the SSE and AVX intrinsics with identical names, so
+// that kernels can be written once as a template over the lane type. The
+// comparisons are the ordered (lt, gt) and unordered negated (nlt, ngt)
+// variants, the latter evaluate to true for NaNs, like !(a < b) in C++.
+
+#ifdef SIMD_SSE
+/// Four floats per instruction using SSE
+struct SSELanes {
+	typedef __m128 type;
+	enum { width = 4 };
+	static type load(const float* p) { return _mm_load_ps(p); }
+	static type loadu(const float* p) { return _mm_loadu_ps(p); }
+	static type set(float f) { return _mm_set1_ps(f); }
+	/// Converts four consecutive unsigned bytes to floats
+	static type bytes(const unsigned char* p) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i b = _mm_cvtsi32_si128((int) (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24)));
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(b,zero),zero));
+	}
+	static void store(float* p, type a) { _mm_storeu_ps(p,a); }
+	static type add(type a, type b) { return _mm_add_ps(a,b); }
+	static type sub(type a, type b) { return _mm_sub_ps(a,b); }
+	static type mul(type a, type b) { return _mm_mul_ps(a,b); }
+	static type div(type a, type b) { return _mm_div_ps(a,b); }
+	/// Returns a * b + c, fused in a single rounding where FMA is available
+	static type madd(type a, type b, type c) {
+#ifdef SIMD_FMA
+		return _mm_fmadd_ps(a,b,c);
+#else
+		return _mm_add_ps(_mm_mul_ps(a,b),c);
+#endif
+	}
+	static type sqrt(type a) { return _mm_sqrt_ps(a); }
+	static type min(type a, type b) { return _mm_min_ps(a,b); }
+	static type max(type a, type b) { return _mm_max_ps(a,b); }
+	static type both(type a, type b) { return _mm_and_ps(a,b); }
+	static type either(type a, type b) { return _mm_or_ps(a,b); }
+	static type lt(type a, type b) { return _mm_cmplt_ps(a,b); }
+	static type le(type a, type b) { return _mm_cmple_ps(a,b); }
+	static type gt(type a, type b) { return _mm_cmpgt_ps(a,b); }
+	static type nlt(type a, type b) { return _mm_cmpnlt_ps(a,b); }
+	static type ngt(type a, type b) { return _mm_cmpngt_ps(a,b); }
+	static int mask(type a) { return _mm_movemask_ps(a); }
+};
+#endif
+
+#ifdef SIMD_AVX
+/// Eight floats per instruction using AVX
+struct AVXLanes {
+	typedef __m256 type;
+	enum { width = 8 };
+	static type load(const float* p) { return _mm256_load_ps(p); }
+	static type loadu(const float* p) { return _mm256_loadu_ps(p); }
+	static type set(float f) { return _mm256_set1_ps(f); }
+	static void store(float* p, type a) { _mm256_storeu_ps(p,a); }
+	static type add(type a, type b) { return _mm256_add_ps(a,b); }
+	static type sub(type a, type b) { return _mm256_sub_ps(a,b); }
+	static type mul(type a, type b) { return _mm256_mul_ps(a,b); }
+	static type div(type a, type b) { return _mm256_div_ps(a,b); }
+	/// Returns a * b + c, fused in a single rounding where FMA is available
+	static type madd(type a, type b, type c) {
+#ifdef SIMD_FMA
+		return _mm256_fmadd_ps(a,b,c);
+#else
+		return _mm256_add_ps(_mm256_mul_ps(a,b),c);
+#endif
+	}
+	static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+	static type min(type a, type b) { return _mm256_min_ps(a,b); }
+	static type max(type a, type b) { return _mm256_max_ps(a,b); }
+	static type both(type a, type b) { return _mm256_and_ps(a,b); }
+	static type either(type a, type b) { return _mm256_or_ps(a,b); }
+	static type lt(type a, type b) { return _mm256_cmp_ps(a,b,_CMP_LT_OQ); }
+	static type le(type a, type b) { return _mm256_cmp_ps(a,b,_CMP_LE_OQ); }
+	static type gt(type a, type b) { return _mm256_cmp_ps(a,b,_CMP_GT_OQ); }
+	static type nlt(type a, type b) { return _mm256_cmp_ps(a,b,_CMP_NLT_UQ); }
+	static type ngt(type a, type b) { return _mm256_cmp_ps(a,b,_CMP_NGT_UQ); }
+	static int mask(type a) { return _mm256_movemask_ps(a); }
+};
+#endif
+
+#endif
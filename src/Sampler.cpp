@@ -0,0 +1,163 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include "Sampler.h"
+
+namespace {
+	boost::uint32_t ReverseBits(boost::uint32_t x) {
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+		x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+		x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+		x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+		return x;
+	}
+
+	boost::uint32_t Hash(boost::uint32_t x, boost::uint32_t seed) {
+		x ^= seed * 0x9e3779b9;
+		x ^= x >> 16;
+		x *= 0x7feb352d;
+		x ^= x >> 15;
+		x *= 0x846ca68b;
+		x ^= x >> 16;
+		return x;
+	}
+
+	// A random permutation of the bits of x, of which every bit only depends
+	// on the more significant bits of x, which amounts to Owen scrambling of
+	// the binary fraction x / 2^32. Burley 2020, Practical Hash-based Owen
+	// Scrambling, after Laine and Karras 2011.
+	boost::uint32_t Scramble(boost::uint32_t x, boost::uint32_t seed) {
+		x = ReverseBits(x);
+		x += seed;
+		x ^= x * 0x6c50b47c;
+		x ^= x * 0xb82f1e52;
+		x ^= x * 0xc7afe638;
+		x ^= x * 0x8d22f6e6;
+		return ReverseBits(x);
+	}
+
+	// The primitive polynomials and initial direction numbers of the first
+	// dimensions of the Sobol sequence after the first, Joe and Kuo 2008.
+	const int SOBOL_DIMENSIONS = 16;
+	const struct { int s, a, m[6]; } JoeKuo[SOBOL_DIMENSIONS-1] = {
+		{1,0,{1}},
+		{2,1,{1,3}},
+		{3,1,{1,3,1}},
+		{3,2,{1,1,1}},
+		{4,1,{1,1,3,3}},
+		{4,4,{1,3,5,13}},
+		{5,2,{1,1,5,5,17}},
+		{5,4,{1,1,5,5,5}},
+		{5,7,{1,1,7,11,19}},
+		{5,11,{1,1,5,1,1}},
+		{5,13,{1,1,1,3,11}},
+		{5,14,{1,3,5,5,31}},
+		{6,1,{1,3,3,9,7,49}},
+		{6,13,{1,1,1,15,21,21}},
+		{6,16,{1,3,1,13,27,49}}
+	};
+
+	// The direction numbers of the Sobol sequence, which are computed once.
+	// The first dimension is the van der Corput sequence.
+	class SobolMatrices {
+	public:
+		boost::uint32_t v[SOBOL_DIMENSIONS][32];
+		SobolMatrices() {
+			for ( int i = 0; i < 32; ++ i ) v[0][i] = 1u << (31-i);
+			for ( int d = 1; d < SOBOL_DIMENSIONS; ++ d ) {
+				const int s = JoeKuo[d-1].s;
+				const int a = JoeKuo[d-1].a;
+				for ( int i = 0; i < 32; ++ i ) {
+					if ( i < s ) {
+						v[d][i] = (boost::uint32_t) JoeKuo[d-1].m[i] << (31-i);
+					} else {
+						v[d][i] = v[d][i-s] ^ (v[d][i-s] >> s);
+						for ( int k = 1; k < s; ++ k ) {
+							if ( (a >> (s-1-k)) & 1 ) v[d][i] ^= v[d][i-k];
+						}
+					}
+				}
+			}
+		}
+		boost::uint32_t operator()(boost::uint32_t i, int d) const {
+			boost::uint32_t r = 0;
+			for ( int j = 0; i; i >>= 1, ++ j ) {
+				if ( i & 1 ) r ^= v[d][j];
+			}
+			return r;
+		}
+	};
+	const SobolMatrices Sobol;
+
+	float ToFloat(boost::uint32_t x) {
+		// The upper 24 bits fill the mantissa of a float exactly
+		return (x >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+Sampler::Sampler(boost::uint64_t seed, bool quasi_random, boost::uint32_t first_path) : rng(seed), quasi(quasi_random), index(0), dimension(0) {
+	scramble = rng.Next();
+	if ( first_path ) rng.Seed(RandomGenerator::DeriveSeed(seed,first_path));
+}
+
+void Sampler::StartPath(boost::uint32_t i, int d) {
+	index = i;
+	dimension = d;
+}
+
+float Sampler::Get1D() {
+	if ( !quasi ) {
+		dimension ++;
+		return rng.Uniform();
+	}
+	if ( dimension < SOBOL_DIMENSIONS ) {
+		const int d = dimension++;
+		const boost::uint32_t i = Scramble(index,scramble);
+		return ToFloat(Scramble(Sobol(i,d),Hash(d,scramble)));
+	}
+	// The remaining dimensions are taken from the first dimension of the
+	// Sobol sequence, of which the order of the points is shuffled for
+	// every dimension to prevent correlation between the dimensions, while
+	// the first 2^k points still form a stratified set.
+	const boost::uint32_t seed = Hash(dimension++,scramble);
+	const boost::uint32_t i = Scramble(index,Hash(seed,0));
+	return ToFloat(Scramble(Sobol(i,0),Hash(seed,1)));
+}
+
+void Sampler::Get2D(float& u1, float& u2) {
+	if ( !quasi ) {
+		dimension += 2;
+		u1 = rng.Uniform();
+		u2 = rng.Uniform();
+		return;
+	}
+	if ( dimension + 1 < SOBOL_DIMENSIONS ) {
+		u1 = Get1D();
+		u2 = Get1D();
+		return;
+	}
+	// The first two dimensions of the Sobol sequence are stratified in two
+	// dimensions for any power of two number of points.
+	const boost::uint32_t seed = Hash(dimension,scramble);
+	dimension += 2;
+	const boost::uint32_t i = Scramble(index,Hash(seed,0));
+	u1 = ToFloat(Scramble(Sobol(i,0),Hash(seed,1)));
+	u2 = ToFloat(Scramble(Sobol(i,1),Hash(seed,2)));
+}
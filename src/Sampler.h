@@ -0,0 +1,66 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <boost/cstdint.hpp>
+
+#include "Random.h"
+
+/// Generates the uniformly distributed numbers in [0,1) from which the paths
+/// are sampled. The numbers are either pseudo random or quasi random. The
+/// quasi random numbers of a path are the point of an Owen scrambled Sobol
+/// sequence that is indexed by the number of the path, of which every
+/// dimension is a dimension of the path, such as the direction in which it
+/// is emitted or the direction in which it is scattered at the second
+/// bounce. The dimensions beyond the first sixteen, which are reached by
+/// the later bounces, are drawn from independently scrambled and shuffled
+/// two dimensional Sobol sequences. This distributes the paths more evenly
+/// over the domain than pure random sampling, so that the noise in the
+/// impulse response decreases faster with the number of samples.
+class Sampler {
+private:
+	RandomGenerator rng;
+	bool quasi;
+	boost::uint32_t scramble;
+	boost::uint32_t index;
+	int dimension;
+public:
+	/// Creates a sampler of which the numbers are determined by seed. The
+	/// numbers are quasi random if quasi_random is true. The pseudo random
+	/// numbers of the paths from first_path onwards form an independent
+	/// sequence, so that the paths of a render can be divided over samplers.
+	Sampler(boost::uint64_t seed, bool quasi_random, boost::uint32_t first_path = 0);
+	/// Starts or resumes the path with number index, of which the first
+	/// dimension numbers are already drawn.
+	void StartPath(boost::uint32_t index, int dimension = 0);
+	/// Returns the number of dimensions of the current path that are drawn,
+	/// so that the path can be resumed later on.
+	int getDimension() const { return dimension; }
+	/// Returns the next number of the current path.
+	float Get1D();
+	/// Returns the next pair of numbers of the current path, which are
+	/// stratified together in case of quasi random numbers.
+	void Get2D(float& u1, float& u2);
+	/// Returns whether the numbers are quasi random.
+	bool isQuasiRandom() const { return quasi; }
+};
+
+#endif
@@ -19,6 +19,7 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
 
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
@@ -30,7 +31,9 @@
 #include "Material.h"
 #include "MonoRecorder.h"
 #include "Distributions.h"
+#include "SIMD.h"
 #include "Scene.h"
+#include "Convergence.h"
 
 // Contributions that are negative, zero, denormal, NaN or infinite are to be discarded
 #ifdef _MSC_VER
@@ -46,53 +49,296 @@
 #define EXP 1000.0f
 #define EXP_INT (EXP + 1.0f)
 
-gmtl::Rayf* Scene::Bounce(int band, gmtl::Rayf* sound_ray,
-						  gmtl::Vec3f*& surface_normal, float& l,
-						  Material*& mat, BounceType& bt) {
-	gmtl::Point3f* p = 0;
-	gmtl::Rayf* old_sound_ray = 0;
+// The number of packets of which the rays are emitted and sorted together
+#define PACKETS_PER_BATCH 64
+
+bool Scene::Bounce(int band, Sampler& sampler, gmtl::Rayf& sound_ray,
+				   gmtl::Vec3f& surface_normal, float& l,
+				   Material*& mat, BounceType& bt) {
+	gmtl::Point3f p;
 
 	// Only testing intersections with meshes[0] because it
 	// contains a combination of all meshes added to the scene
-	if ( meshes[0]->RayIntersection(
-		sound_ray,p,surface_normal,mat) ) {
+	if ( ! meshes[0]->RayIntersection(
+		sound_ray,p,surface_normal,mat) ) return false;
+
+	gmtl::Vec3f v;
+	Scatter(band, sampler, sound_ray.mDir, mat, surface_normal, bt, v);
+
+	const gmtl::Vec3f dist = p - sound_ray.mOrigin;
+	l = gmtl::length(dist);
+	sound_ray = gmtl::Rayf(p,v);
+	return true;
+}
+
+void Scene::Scatter(int band, Sampler& sampler, const gmtl::Vec3f& dir, Material* mat,
+					gmtl::Vec3f& surface_normal, BounceType& bt,
+					gmtl::Vec3f& v) {
+	bt = mat->Bounce(band,sampler.Get1D());
+
+	const float spec = mat->specularity_coefficient[band];
+
+	float u1, u2;
+	sampler.Get2D(u1,u2);
+	if ( bt == REFRACT ) {
+		surface_normal *= -1.0f;
+		Sample_Hemi(v, surface_normal, dir, spec, u1, u2);
+	} else {
+		gmtl::Vec3f refl = gmtl::reflect(
+			refl, dir, surface_normal);
+		Sample_Hemi(v, surface_normal, refl, spec, u1, u2);
+	}
+}
 
-		bt = mat->Bounce(band);
-		gmtl::Vec3f v;
+bool Scene::Continue(Sampler& sampler, float& intensity) {
+	if ( roulette_threshold > 0.0f ) {
+		if ( intensity >= roulette_threshold ) return true;
+		const float p = intensity / roulette_threshold;
+		if ( sampler.Get1D() >= p ) return false;
+		intensity /= p;
+		return true;
+	}
+	// Arbitrary constant, ideally this would be determined
+	// based on some heuristics or previously collected
+	// samples.
+	return intensity >= 0.00000001;
+}
 
-		const float spec = mat->specularity_coefficient[band];
+bool Scene::WithinResponse(float l) const {
+	return max_ir_length <= 0.0f || l <= max_ir_length * 343.0f;
+}
 
-		if ( bt == REFRACT ) {
-			gmtl::Vec3f* n2 = new gmtl::Vec3f(-*surface_normal);
-			delete surface_normal;
-			surface_normal = n2;
-			Sample_Hemi(v, *surface_normal, sound_ray->mDir, spec);
+float Scene::Contribution(int band, int num_bounces, BounceType bt,
+						  float spec_coef, const gmtl::Vec3f* surface_normal,
+						  const gmtl::Vec3f& prev_ray_dir,
+						  const gmtl::Vec3f& lsdir, float l,
+						  float intensity, float absorbtion_factor) {
+	if ( num_bounces ) {
+
+		// Because triangles in EAR are two-sided we might need
+		// to re-orient the surface normal of the triangle based
+		// on its dot product with the linesegment direction
+		const float dot = gmtl::dot(lsdir,*surface_normal);
+		if ( !(dot > 0) ) return 0.0f;
+
+		// A valid path from the intersection point to the
+		// listener location has been found, now we need to
+		// determine the intensity of the contribution of
+		// the ray.
+		if ( bt == REFLECT ) {
+			gmtl::Vec3f refl_vector;
+			gmtl::reflect(refl_vector,
+				prev_ray_dir,*surface_normal);
+
+			const float diff_factor =
+				-gmtl::dot(*surface_normal,
+				prev_ray_dir);
+
+			const float spec_factor = (std::max)(0.0f,
+				gmtl::dot(refl_vector,lsdir));
+
+			const float factor = spec_coef *
+				EXP_INT * pow(spec_factor,EXP) +
+				(1.0f - spec_coef) * diff_factor;
+
+			intensity *= factor;
 		} else {
-			gmtl::Vec3f refl = gmtl::reflect(
-				refl, sound_ray->mDir, *surface_normal);
-			Sample_Hemi(v, *surface_normal, refl, spec);
+			const float diff_factor = gmtl::dot(
+				*surface_normal,prev_ray_dir);
+			const float spec_factor = (std::max)(0.0f,
+				gmtl::dot(prev_ray_dir,lsdir));
+
+			const float factor = spec_coef *
+				EXP_INT * pow(spec_factor,EXP) +
+				(1.0f - spec_coef) * diff_factor;
+
+			intensity *= factor;
+		}
+	}
+
+	intensity *= pow(absorbtion_factor,l);
+	intensity *= INV_HEMI_2(l);
+
+#ifdef DO_PHASE_INVERSION
+	if ( num_bounces % 2 ) intensity *= -1.0f;
+#endif
+	return intensity;
+}
+
+namespace {
+#if defined(SIMD_SSE) || defined(SIMD_AVX)
+	// Raises x to the power e by repeated squaring
+	template <typename L>
+	inline typename L::type PowLanes(typename L::type x, int e) {
+		typename L::type r = L::set(1.0f);
+		for ( ; e; e >>= 1 ) {
+			if ( e & 1 ) r = L::mul(r,x);
+			x = L::mul(x,x);
+		}
+		return r;
+	}
+
+	// Evaluates the directional factor of Contribution() and the distance
+	// and direction from the vertex p to count recorders, rounded up to a
+	// multiple of the lane width. The specular lobe points in direction
+	// lobe, spec and diff are the weights of the specular and diffuse parts.
+	// Recorders behind the surface get a factor of zero. Without
+	// directional, the factor is one.
+	template <typename L>
+	void ContributionLanes(const float* x, const float* y, const float* z, int count,
+						   const gmtl::Point3f& p, const gmtl::Vec3f& normal, const gmtl::Vec3f& lobe,
+						   float spec, float diff, bool directional,
+						   float* factor, float* l, float* dx, float* dy, float* dz) {
+		typedef typename L::type T;
+		const T px = L::set(p[0]), py = L::set(p[1]), pz = L::set(p[2]);
+		const T nx = L::set(normal[0]), ny = L::set(normal[1]), nz = L::set(normal[2]);
+		const T ox = L::set(lobe[0]), oy = L::set(lobe[1]), oz = L::set(lobe[2]);
+		const T zero = L::set(0.0f);
+		const T one = L::set(1.0f);
+		for ( int i = 0; i < count; i += L::width ) {
+			const T lx = L::sub(L::loadu(x+i),px);
+			const T ly = L::sub(L::loadu(y+i),py);
+			const T lz = L::sub(L::loadu(z+i),pz);
+			const T len = L::sqrt(L::add(L::add(L::mul(lx,lx),L::mul(ly,ly)),L::mul(lz,lz)));
+			const T inv = L::div(one,len);
+			const T ux = L::mul(lx,inv), uy = L::mul(ly,inv), uz = L::mul(lz,inv);
+			L::store(l+i,len);
+			L::store(dx+i,ux);
+			L::store(dy+i,uy);
+			L::store(dz+i,uz);
+			if ( !directional ) {
+				L::store(factor+i,one);
+				continue;
+			}
+			const T cos_normal = L::add(L::add(L::mul(ux,nx),L::mul(uy,ny)),L::mul(uz,nz));
+			const T spec_factor = L::max(zero,L::add(L::add(L::mul(ux,ox),L::mul(uy,oy)),L::mul(uz,oz)));
+			const T f = L::add(L::mul(L::set(spec),PowLanes<L>(spec_factor,(int) EXP)),L::set(diff));
+			L::store(factor+i,L::both(L::gt(cos_normal,zero),f));
 		}
+	}
+#else
+	// One recorder at a time without SIMD
+	void ContributionScalar(const float* x, const float* y, const float* z, int count,
+						   const gmtl::Point3f& p, const gmtl::Vec3f& normal, const gmtl::Vec3f& lobe,
+						   float spec, float diff, bool directional,
+						   float* factor, float* l, float* dx, float* dy, float* dz) {
+		for ( int i = 0; i < count; ++ i ) {
+			const gmtl::Vec3f ls(x[i]-p[0],y[i]-p[1],z[i]-p[2]);
+			l[i] = gmtl::length(ls);
+			const gmtl::Vec3f lsdir = ls / l[i];
+			dx[i] = lsdir[0]; dy[i] = lsdir[1]; dz[i] = lsdir[2];
+			if ( !directional ) {
+				factor[i] = 1.0f;
+			} else if ( !(gmtl::dot(lsdir,normal) > 0) ) {
+				factor[i] = 0.0f;
+			} else {
+				const float spec_factor = (std::max)(0.0f,gmtl::dot(lobe,lsdir));
+				factor[i] = spec * pow(spec_factor,EXP) + diff;
+			}
+		}
+	}
+#endif
+}
 
-		old_sound_ray = new gmtl::Rayf(*p,v);
-		const gmtl::Vec3f dist = *p - sound_ray->mOrigin;
-		l = gmtl::length(dist);
+Scene::RecorderLocations::RecorderLocations(const std::vector<Recorder*>& recs, int keyframeID) {
+	// The padding is placed far away to keep the distances finite
+	const size_t padded = (recs.size() + MAX_PACKET_SIZE - 1) / MAX_PACKET_SIZE * MAX_PACKET_SIZE;
+	x.assign(padded,1e6f);
+	y.assign(padded,1e6f);
+	z.assign(padded,1e6f);
+	for ( size_t i = 0; i < recs.size(); ++ i ) {
+		const gmtl::Point3f& location = recs[i]->getLocation(keyframeID);
+		x[i] = location[0];
+		y[i] = location[1];
+		z[i] = location[2];
 	}
-	delete p;
-	return old_sound_ray;
 }
 
-gmtl::LineSegf* Scene::Connect(const gmtl::Point3f* p,
-							   const gmtl::Point3f& x) {
-	// Create a line segment and test for line-triangle intersections
-	gmtl::LineSegf* ls = new gmtl::LineSegf(*p,x);
+void Scene::ConnectVertex(int band, int num_bounces, BounceType bt,
+						  float spec_coef, const gmtl::Vec3f& surface_normal,
+						  const gmtl::Vec3f& prev_ray_dir, const gmtl::Point3f& p,
+						  float path_length, float intensity, float absorbtion_factor,
+						  const std::vector<Recorder*>& recs,
+						  const RecorderLocations& locations, int keyframeID,
+						  Convergence* convergence, boost::uint64_t& shadow_rays) {
+	float factor[MAX_PACKET_SIZE];
+	float l[MAX_PACKET_SIZE];
+	float dx[MAX_PACKET_SIZE], dy[MAX_PACKET_SIZE], dz[MAX_PACKET_SIZE];
+	gmtl::Point3f points[MAX_PACKET_SIZE];
+	float contribution[MAX_PACKET_SIZE];
+	int index[MAX_PACKET_SIZE];
+	bool blocked[MAX_PACKET_SIZE];
+
+	// The parts of Contribution() that do not depend on the recorder
+	const bool directional = num_bounces > 0;
+	gmtl::Vec3f lobe;
+	float diff_factor = 0.0f;
+	if ( directional && bt == REFLECT ) {
+		gmtl::reflect(lobe,prev_ray_dir,surface_normal);
+		diff_factor = -gmtl::dot(surface_normal,prev_ray_dir);
+	} else if ( directional ) {
+		lobe = prev_ray_dir;
+		diff_factor = gmtl::dot(surface_normal,prev_ray_dir);
+	}
+	const float spec = spec_coef * EXP_INT;
+	const float diff = (1.0f - spec_coef) * diff_factor;
+
+	const int count = (int) recs.size();
+	for ( int first = 0; first < count; first += MAX_PACKET_SIZE ) {
+		const int size = (std::min)(MAX_PACKET_SIZE,count-first);
+#if defined(SIMD_AVX)
+		ContributionLanes<AVXLanes>(
+#elif defined(SIMD_SSE)
+		ContributionLanes<SSELanes>(
+#else
+		ContributionScalar(
+#endif
+			&locations.x[first],&locations.y[first],&locations.z[first],size,
+			p,surface_normal,lobe,spec,diff,directional,factor,l,dx,dy,dz);
+
+		// Only the recorders that receive a contribution are tested for
+		// occlusion
+		int n = 0;
+		for ( int i = 0; i < size; ++ i ) {
+			float c = intensity * factor[i] * pow(absorbtion_factor,l[i]) * INV_HEMI_2(l[i]);
+#ifdef DO_PHASE_INVERSION
+			if ( num_bounces % 2 ) c *= -1.0f;
+#endif
+			if ( INVALID_FLOAT(c) || !WithinResponse(path_length+l[i]) ) continue;
+			points[n] = gmtl::Point3f(locations.x[first+i],locations.y[first+i],locations.z[first+i]);
+			contribution[n] = c;
+			index[n++] = i;
+		}
+		if ( !n ) continue;
+		meshes[0]->LineIntersection(n,p,points,blocked);
+		shadow_rays += n;
+
+		for ( int j = 0; j < n; ++ j ) {
+			if ( blocked[j] ) continue;
+			const int i = index[j];
+			recs[first+i]->Record(gmtl::Vec3f(dx[i],dy[i],dz[i]),contribution[j],
+				(path_length+l[i])/343.0f,path_length+l[i],band,keyframeID);
+			if ( convergence ) convergence->Record((path_length+l[i])/343.0f,contribution[j]);
+		}
+	}
+}
+
+bool Scene::Connect(const gmtl::Point3f& p,
+					const gmtl::Point3f& x) {
 	// Only testing intersections with meshes[0] because it contains
 	// a combination of all meshes added to the scene
-	if ( meshes[0]->LineIntersection(ls) ) {
-		delete ls;
-		return 0;
-	} else {
-		return ls;
-	}
+	return ! meshes[0]->LineIntersection(p,x);
+}
+Scene::Scene() {
+	rays_traced = shadow_rays_traced = 0;
+	packet_size = 0;
+	wavefront_size = 0;
+	quasi_random = false;
+	roulette_threshold = 0.0f;
+	max_ir_length = 0.0f;
+	target_error = 0.0f;
+	checkpoint_interval = 300.0f;
+	resume = false;
 }
 void Scene::addListener(Recorder* l) {
 	listeners.push_back(l);
@@ -107,31 +353,25 @@ void Scene::addMesh(Mesh* m) {
 void Scene::addMaterial(Material* m) {
 	Mesh::materials[m->name] = m;
 }
+void Scene::Prepare(bool build_hierarchy, const std::string& cache_dir, bool compact_nodes, bool compact_triangles) {
+	if ( meshes.empty() ) return;
+	meshes[0]->Prepare(build_hierarchy,cache_dir,compact_nodes,compact_triangles);
+}
 
-void Scene::Render(int band, int sound, float absorbtion_factor,
-				   int num_samples, float dry,
-				   const std::vector<Recorder*>& recs,
-				   int keyframeID) {
-
-	gmtl::Math::seedRandom((int)time(NULL));
-
-	AbstractSoundFile* currentSound = sources[sound];
-	const gmtl::Point3f sfloc =
-		currentSound->getLocation(keyframeID);
-
-	float amount = 0;
-
-	for( int sample_count=0; sample_count < num_samples;
-		sample_count ++ ) {
-
-		amount += 1.0f;
-
-		DrawProgressBar(sample_count,num_samples);
-
+void Scene::TraceDepthFirst(int band, Sampler& sampler, AbstractSoundFile* sound,
+							float absorbtion_factor, int first_sample, int end_sample,
+							const std::vector<Recorder*>& recs,
+							const RecorderLocations& locations, int keyframeID,
+							Convergence* convergence, boost::uint64_t& rays,
+							boost::uint64_t& shadow_rays) {
+	for( int sample = first_sample; sample < end_sample; sample ++ ) {
+
+		// The state of the path is kept on the stack, so that no memory
+		// is allocated for every bounce.
+		sampler.StartPath(sample);
 		float sample_intensity = 1.0;
-		gmtl::Rayf* sound_ray = 0;
-		gmtl::Rayf* old_sound_ray = 0;
-		gmtl::Vec3f* surface_normal = 0;
+		gmtl::Rayf sound_ray = sound->SoundRay(sampler,keyframeID);
+		gmtl::Vec3f surface_normal;
 		float total_path_length = 0.0f;
 
 		gmtl::Vec3f prev_ray_dir = gmtl::Vec3f();
@@ -143,28 +383,26 @@ void Scene::Render(int band, int sound, float absorbtion_factor,
 		for( int num_bounces = 0; num_bounces < 1000;
 			num_bounces ++ ) {
 
-			surface_normal = 0;
-			mat = 0;
-			if ( ! sound_ray ) {
-				sound_ray = currentSound->SoundRay(keyframeID);
-			} else {
-				old_sound_ray = Bounce(band,sound_ray,
+			if ( num_bounces ) {
+				const bool hit = Bounce(band,sampler,sound_ray,
 					surface_normal,segment_length,mat,bt);
+				rays ++;
+
+				// Failed to generate valid bounce, terminate path
+				if ( ! hit ) break;
 
 				sample_intensity *= pow(absorbtion_factor,segment_length);
 
 				total_path_length += segment_length;
-				delete sound_ray;
-				sound_ray = old_sound_ray;
+
+				// The path arrives after the end of the response
+				if ( !WithinResponse(total_path_length) ) break;
 			}
 
 			const float spec_coef = (mat > 0)
 				? mat->specularity_coefficient[band]
 				: 0;
 
-			// Failed to generate valid bounce, terminate path
-			if ( sound_ray == 0 ) break;
-
 			// Account for energy loss by absorbtion:
 			if ( num_bounces > 0 ) {				
 				sample_intensity *= mat->absorption_coefficient[band];
@@ -182,106 +420,90 @@ void Scene::Render(int band, int sound, float absorbtion_factor,
 			// phenomena like Doppler effect. In case the sound
 			// source emits from a mesh, the direct sound is
 			// sampled regardless.
-			if ( num_bounces || currentSound->isMeshSource() ) {
-
-				// For every recorder in the scene..
-				for ( std::vector<Recorder*>::const_iterator
-					it = recs.begin(); it != recs.end(); ++ it ) {
-					Recorder* rec = *it;
-
-					// See if the intersection point of the ray is
-					// 'visible' from the recorder location
-					gmtl::LineSegf* ls = Connect(&sound_ray->mOrigin,
-						rec->getLocation(keyframeID));
-
-					if ( ls ) {
-
-						// Because triangles in EAR are two-sided we might need
-						// to re-orient the surface normal of the triangle based
-						// on its dot product with the linesegment direction
-						const gmtl::Vec3f lsdir = gmtl::makeNormal(ls->mDir);
-						bool valid = true;
-
-						const float dot = num_bounces
-							? gmtl::dot(lsdir,*surface_normal)
-							: 1.0f;
-
-						if ( dot > 0 ) {
-							float this_sample_intensity =
-								sample_intensity_before_bounce;
-
-							// A valid path from the intersection point to the
-							// listener location has been found, now we need to
-							// determine the intensity of the contribution of
-							// the ray.
-							if ( num_bounces) {
-
-							if ( bt == REFLECT ) {
-								gmtl::Vec3f refl_vector;
-								gmtl::reflect(refl_vector,
-									prev_ray_dir,*surface_normal);
-
-								const float diff_factor =
-									-gmtl::dot(*surface_normal,
-									prev_ray_dir);
-
-								const float spec_factor = (std::max)(0.0f,
-									gmtl::dot(refl_vector,lsdir));
-
-								const float factor = spec_coef *
-									EXP_INT * pow(spec_factor,EXP) +
-									(1.0f - spec_coef) * diff_factor;
-
-								this_sample_intensity *= factor;
-							} else {
-								const float diff_factor = gmtl::dot(
-									*surface_normal,prev_ray_dir);
-								const float spec_factor = (std::max)(0.0f,
-									gmtl::dot(prev_ray_dir,lsdir));
-
-								const float factor = spec_coef *
-									EXP_INT * pow(spec_factor,EXP) +
-									(1.0f - spec_coef) * diff_factor;
-
-								this_sample_intensity *= factor;
-							}
-							}
-
-							const float l = ls->getLength();
-							this_sample_intensity *= pow(absorbtion_factor,l);
-							this_sample_intensity *= INV_HEMI_2(l);
-
-							if ( !INVALID_FLOAT(
-								this_sample_intensity) ) {
-#ifdef DO_PHASE_INVERSION
-									if ( num_bounces % 2 ) this_sample_intensity *= -1.0f;
-#endif
-									rec->Record(lsdir,this_sample_intensity,
-										(total_path_length+l)/343.0f,
-										total_path_length+l,band,keyframeID);
-							}
-						}
-					}
-
-					delete ls;
-					ls = 0;
-				}
-
+			if ( num_bounces || sound->isMeshSource() ) {
+
+				// See if the intersection point of the ray is
+				// 'visible' from the recorder locations
+				ConnectVertex(band,num_bounces,bt,spec_coef,
+					surface_normal,prev_ray_dir,sound_ray.mOrigin,
+					total_path_length,sample_intensity_before_bounce,
+					absorbtion_factor,recs,locations,keyframeID,
+					convergence,shadow_rays);
 			}
 
-			// Arbitrary constant, ideally this would be determined
-			// based on some heuristics or previously collected
-			// samples.
-			if ( sample_intensity < 0.00000001 ) break;
-
-			prev_ray_dir = gmtl::makeNormal(sound_ray->mDir);
+			if ( !Continue(sampler,sample_intensity) ) break;
 
-			delete surface_normal;
-			surface_normal = 0;
+			prev_ray_dir = gmtl::makeNormal(sound_ray.mDir);
 		}
-		delete surface_normal;
-		delete sound_ray;
 	}
+}
+
+int Scene::BatchSize(int num_samples) const {
+	// The batches of the packet engine are a multiple of its emission
+	// batches.
+	int batch = (std::max)(num_samples / 64,128);
+	if ( wavefront_size <= 0 && packet_size > 1 ) {
+		const int packet_batch = packet_size * PACKETS_PER_BATCH;
+		batch = (batch + packet_batch - 1) / packet_batch * packet_batch;
+	}
+	return batch;
+}
+
+unsigned int Scene::ResponseLength() const {
+	if ( max_ir_length <= 0.0f ) return 0;
+	// The samples of the longest paths are spread over the square root of
+	// their length, see MonoRecorder::Splat(), and are shifted by the time
+	// difference between the ears of a StereoRecorder.
+	const float max_path_length = max_ir_length * 343.0f;
+	return (unsigned int) (max_ir_length * SAMPLE_RATE + sqrt(max_path_length)) + SAMPLE_RATE / 100;
+}
+
+void Scene::Trace(int band, int sound, float absorbtion_factor,
+				  int first_sample, int end_sample,
+				  const std::vector<Recorder*>& recs, int keyframeID,
+				  boost::uint64_t seed, Convergence* convergence) {
+
+	Sampler sampler(seed,quasi_random,first_sample);
+
+	AbstractSoundFile* currentSound = sources[sound];
+	const RecorderLocations locations(recs,keyframeID);
+
+	boost::uint64_t rays = 0;
+	boost::uint64_t shadow_rays = 0;
+
+	if ( wavefront_size > 0 ) {
+		TraceWavefront(band,sampler,currentSound,
+			absorbtion_factor,first_sample,end_sample,recs,keyframeID,
+			convergence,rays,shadow_rays);
+	} else if ( packet_size > 1 ) {
+		TracePackets(band,sampler,currentSound,
+			absorbtion_factor,first_sample,end_sample,recs,keyframeID,
+			convergence,rays,shadow_rays);
+	} else {
+		TraceDepthFirst(band,sampler,currentSound,
+			absorbtion_factor,first_sample,end_sample,recs,locations,
+			keyframeID,convergence,rays,shadow_rays);
+	}
+
+	// The recorders of a chunk wait to be added to the impulse response
+	// without their logs, see RenderTask.
+	for ( std::vector<Recorder*>::const_iterator it = recs.begin(); it != recs.end(); ++ it ) {
+		(*it)->Flush(true);
+	}
+
+	boost::mutex::scoped_lock lock(statistics_mutex);
+	rays_traced += rays;
+	shadow_rays_traced += shadow_rays;
+}
+
+void Scene::Finish(int band, int sound, float absorbtion_factor, int num_samples,
+				   float dry, const std::vector<Recorder*>& recs, int keyframeID) {
+
+	AbstractSoundFile* currentSound = sources[sound];
+	const gmtl::Point3f sfloc =
+		currentSound->getLocation(keyframeID);
+
+	const float amount = (float) num_samples;
 
 	// For every recorder in the scene...
 	std::vector<Recorder*>::const_iterator it = recs.begin();
@@ -300,13 +522,13 @@ void Scene::Render(int band, int sound, float absorbtion_factor,
 
 		const gmtl::Point3f listener_location =
 			rec->getLocation(keyframeID);
-		gmtl::LineSegf* ls = Connect(&listener_location,sfloc);
-		if ( ls ) {
+		if ( Connect(listener_location,sfloc) ) {
 			const gmtl::Vec3f dist = listener_location - sfloc;
 			const float len = gmtl::length(dist);
 			const gmtl::Vec3f dir = gmtl::makeNormal(dist);
 			rec->Record(dir,INV_SPHERE_2(len)*pow(absorbtion_factor,
 				len)*dry,len/343.0f,len, band, keyframeID);
+			rec->Flush(true);
 		}
 		}
 
@@ -314,8 +536,281 @@ void Scene::Render(int band, int sound, float absorbtion_factor,
 		rec->Multiply(gain*gain);
 
 	}
+}
+
+void Scene::EmitPaths(AbstractSoundFile* sound, Sampler& sampler, int keyframeID,
+					  int first_sample, Path* paths, int count) {
+	for ( int i = 0; i < count; ++ i ) {
+		Path& path = paths[i];
+		sampler.StartPath(first_sample+i);
+		path.ray = sound->SoundRay(sampler,keyframeID);
+		path.sample_index = first_sample+i;
+		path.sample_dimension = sampler.getDimension();
+		path.mat = 0;
+		path.intensity = 1.0f;
+		path.length = 0.0f;
+		path.bounces = 0;
+	}
+}
+
+int Scene::ExtendPaths(int band, Sampler& sampler, float absorbtion_factor,
+					   Path* paths, int count, boost::uint64_t& rays) {
+	gmtl::Rayf packet[MAX_PACKET_SIZE];
+	gmtl::Point3f points[MAX_PACKET_SIZE];
+	gmtl::Vec3f normals[MAX_PACKET_SIZE];
+	Material* mats[MAX_PACKET_SIZE];
+	bool hit[MAX_PACKET_SIZE];
+
+	const int chunk = packet_size > 1 ? packet_size : 1;
+	int alive = 0;
+	for ( int first = 0; first < count; first += chunk ) {
+		const int size = (std::min)(chunk,count-first);
+		for ( int k = 0; k < size; ++ k ) {
+			packet[k] = paths[first+k].ray;
+		}
+		meshes[0]->RayIntersection(size,packet,hit,points,normals,mats);
+		rays += size;
+
+		for ( int k = 0; k < size; ++ k ) {
+			// Failed to generate valid bounce, terminate path
+			if ( !hit[k] ) continue;
+
+			Path& path = paths[first+k];
+			path.surface_normal = normals[k];
+			path.mat = mats[k];
+			gmtl::Vec3f v;
+			sampler.StartPath(path.sample_index,path.sample_dimension);
+			Scatter(band,sampler,path.ray.mDir,path.mat,
+				path.surface_normal,path.bt,v);
+			path.sample_dimension = sampler.getDimension();
+			const gmtl::Vec3f dist = points[k] - path.ray.mOrigin;
+			const float segment_length = gmtl::length(dist);
+			path.ray = gmtl::Rayf(points[k],v);
+			path.bounces ++;
+
+			path.intensity *= pow(absorbtion_factor,segment_length);
+			path.length += segment_length;
+
+			// The path arrives after the end of the response
+			if ( !WithinResponse(path.length) ) continue;
+
+			// Account for energy loss by absorbtion:
+			path.intensity *= path.mat->absorption_coefficient[band];
 
+			if ( INVALID_FLOAT(path.intensity) ) continue;
+
+			// Paths are compacted in place, the paths that remain keep
+			// their relative order.
+			if ( alive != first + k ) paths[alive] = path;
+			alive ++;
+		}
+	}
+	return alive;
 }
+
+void Scene::ConnectPaths(int band, float absorbtion_factor,
+						 const Path* paths, int count, bool mesh_source,
+						 const std::vector<Recorder*>& recs, int keyframeID,
+						 Convergence* convergence, boost::uint64_t& shadow_rays) {
+	gmtl::Point3f points[MAX_PACKET_SIZE];
+	bool blocked[MAX_PACKET_SIZE];
+
+	const int chunk = packet_size > 1 ? packet_size : 1;
+
+	// For every recorder in the scene the shadow rays of all paths
+	// share their end point.
+	for ( std::vector<Recorder*>::const_iterator
+		it = recs.begin(); it != recs.end(); ++ it ) {
+		Recorder* rec = *it;
+
+		const gmtl::Point3f& rec_location =
+			rec->getLocation(keyframeID);
+
+		for ( int first = 0; first < count; first += chunk ) {
+			const int size = (std::min)(chunk,count-first);
+			int n = 0;
+			for ( int k = 0; k < size; ++ k ) {
+				// Direct sound is added in a separate step in the end,
+				// unless the sound source emits from a mesh.
+				const Path& path = paths[first+k];
+				if ( path.bounces || mesh_source ) points[n++] = path.ray.mOrigin;
+			}
+			if ( !n ) continue;
+			meshes[0]->LineIntersection(n,points,rec_location,blocked);
+			shadow_rays += n;
+
+			n = 0;
+			for ( int k = 0; k < size; ++ k ) {
+				const Path& path = paths[first+k];
+				if ( !(path.bounces || mesh_source) ) continue;
+				if ( blocked[n++] ) continue;
+
+				const gmtl::Vec3f ls = rec_location - path.ray.mOrigin;
+				const gmtl::Vec3f lsdir = gmtl::makeNormal(ls);
+				const float l = gmtl::length(ls);
+
+				const float spec_coef = path.mat
+					? path.mat->specularity_coefficient[band]
+					: 0;
+
+				const float this_sample_intensity = Contribution(
+					band,path.bounces,path.bt,spec_coef,&path.surface_normal,
+					path.prev_ray_dir,lsdir,l,
+					path.intensity,absorbtion_factor);
+
+				if ( !INVALID_FLOAT(this_sample_intensity) &&
+					WithinResponse(path.length+l) ) {
+					rec->Record(lsdir,this_sample_intensity,
+						(path.length+l)/343.0f,
+						path.length+l,band,keyframeID);
+					if ( convergence ) convergence->Record((path.length+l)/343.0f,this_sample_intensity);
+				}
+			}
+		}
+	}
+}
+
+int Scene::TerminatePaths(Sampler& sampler, Path* paths, int count) {
+	int alive = 0;
+	for ( int i = 0; i < count; ++ i ) {
+		Path& path = paths[i];
+
+		if ( path.bounces + 1 >= 1000 ) continue;
+		sampler.StartPath(path.sample_index,path.sample_dimension);
+		if ( !Continue(sampler,path.intensity) ) continue;
+		path.sample_dimension = sampler.getDimension();
+
+		path.prev_ray_dir = gmtl::makeNormal(path.ray.mDir);
+		if ( alive != i ) paths[alive] = path;
+		alive ++;
+	}
+	return alive;
+}
+
+void Scene::TracePackets(int band, Sampler& sampler, AbstractSoundFile* sound,
+						 float absorbtion_factor, int first_sample, int end_sample,
+						 const std::vector<Recorder*>& recs, int keyframeID,
+						 Convergence* convergence, boost::uint64_t& rays,
+						 boost::uint64_t& shadow_rays) {
+
+	const bool mesh_source = sound->isMeshSource();
+
+	// Rays are emitted in batches of multiple packets and sorted by their
+	// direction, so that the rays in a packet travel in similar directions
+	// and hit nearby surfaces. Reordering the samples does not change
+	// their distribution.
+	const int batch_size = packet_size * PACKETS_PER_BATCH;
+	std::vector<Path> batch(batch_size);
+	std::vector< std::pair<unsigned int,int> > order(batch_size);
+	Path packet[MAX_PACKET_SIZE];
+
+	for( int sample = first_sample; sample < end_sample;
+		sample += batch_size ) {
+
+		const int batch_count = (std::min)(batch_size,end_sample-sample);
+		EmitPaths(sound,sampler,keyframeID,sample,&batch[0],batch_count);
+		for ( int i = 0; i < batch_count; ++ i ) {
+			order[i] = std::make_pair(Direction_Cell(batch[i].ray.mDir,4),i);
+		}
+		std::sort(order.begin(),order.begin()+batch_count);
+
+		// Every packet is traced until all of its paths are terminated,
+		// before the next packet is started.
+		for( int first = 0; first < batch_count; first += packet_size ) {
+			int size = (std::min)(packet_size,batch_count-first);
+			for ( int i = 0; i < size; ++ i ) {
+				packet[i] = batch[order[first+i].second];
+			}
+			while ( true ) {
+				ConnectPaths(band,absorbtion_factor,packet,size,mesh_source,
+					recs,keyframeID,convergence,shadow_rays);
+				size = TerminatePaths(sampler,packet,size);
+				if ( !size ) break;
+				size = ExtendPaths(band,sampler,absorbtion_factor,packet,size,rays);
+				if ( !size ) break;
+			}
+		}
+	}
+}
+
+namespace {
+	// Interleaves the lower ten bits of x with zeros, such that two zero
+	// bits separate every original bit, to construct a Morton code.
+	inline boost::uint64_t SpreadBits(unsigned int x) {
+		x &= 0x3ff;
+		x = (x | (x << 16)) & 0x030000ff;
+		x = (x | (x << 8)) & 0x0300f00f;
+		x = (x | (x << 4)) & 0x030c30c3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+}
+
+void Scene::TraceWavefront(int band, Sampler& sampler, AbstractSoundFile* sound,
+						   float absorbtion_factor, int first_sample, int end_sample,
+						   const std::vector<Recorder*>& recs, int keyframeID,
+						   Convergence* convergence, boost::uint64_t& rays,
+						   boost::uint64_t& shadow_rays) {
+
+	const bool mesh_source = sound->isMeshSource();
+
+	// The pool of in-flight paths. Terminated paths are removed from the
+	// pool after every stage and the pool is refilled with new paths
+	// until all samples have been emitted.
+	std::vector<Path> pool(wavefront_size);
+	std::vector<Path> sorted(wavefront_size);
+	std::vector< std::pair<boost::uint64_t,int> > order(wavefront_size);
+	int count = 0;
+	int emitted = first_sample;
+
+	// The origins of the rays are quantized to a 1024^3 grid over the
+	// bounds of the scene for sorting.
+	const Mesh* mesh = meshes[0];
+	const float scale[3] = {
+		1023.0f / (std::max)(mesh->xmax - mesh->xmin,1e-6f),
+		1023.0f / (std::max)(mesh->ymax - mesh->ymin,1e-6f),
+		1023.0f / (std::max)(mesh->zmax - mesh->zmin,1e-6f)};
+	const float offset[3] = {mesh->xmin,mesh->ymin,mesh->zmin};
+
+	while ( count || emitted < end_sample ) {
+
+		// Refill the pool with newly emitted paths
+		const int n = (std::min)(wavefront_size-count,end_sample-emitted);
+		if ( n > 0 ) {
+			EmitPaths(sound,sampler,keyframeID,emitted,&pool[count],n);
+			count += n;
+			emitted += n;
+		}
+
+		// Connect the vertices of all paths to the listeners
+		ConnectPaths(band,absorbtion_factor,&pool[0],count,mesh_source,
+			recs,keyframeID,convergence,shadow_rays);
+		count = TerminatePaths(sampler,&pool[0],count);
+		if ( !count ) continue;
+
+		// Sort the paths by the direction of their rays and then by their
+		// origin, so that subsequent packets of rays are coherent.
+		for ( int i = 0; i < count; ++ i ) {
+			const gmtl::Rayf& r = pool[i].ray;
+			unsigned int q[3];
+			for ( int j = 0; j < 3; ++ j ) {
+				const float f = (r.mOrigin[j] - offset[j]) * scale[j];
+				q[j] = f <= 0.0f ? 0 : (f >= 1023.0f ? 1023 : (unsigned int) f);
+			}
+			const boost::uint64_t morton = SpreadBits(q[0]) | (SpreadBits(q[1]) << 1) | (SpreadBits(q[2]) << 2);
+			order[i] = std::make_pair(((boost::uint64_t) Direction_Cell(r.mDir,4) << 30) | morton,i);
+		}
+		std::sort(order.begin(),order.begin()+count);
+		for ( int i = 0; i < count; ++ i ) {
+			sorted[i] = pool[order[i].second];
+		}
+		pool.swap(sorted);
+
+		// Trace the rays of all paths to the next surface
+		count = ExtendPaths(band,sampler,absorbtion_factor,&pool[0],count,rays);
+	}
+}
+
 Scene::~Scene() {
 	{std::vector<Recorder*>::const_iterator it = listeners.begin();
 	for ( ; it != listeners.end(); ++ it ) {
@@ -25,6 +25,7 @@
 
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/cstdint.hpp>
 
 #include <gmtl/gmtl.h>
 #include <gmtl/Vec.h>
@@ -33,32 +34,150 @@
 #include "Material.h"
 #include "Recorder.h"
 #include "Distributions.h"
+#include "Sampler.h"
+
+class Convergence;
 
 /// This class encapsulates all datatypes in the .EAR file format and provides
 /// methods to tracing the rays from the sound sources bouncing off of the
-/// meshes into the recorders. Ideally this class would also create a reference
-/// to some sort of grid acceleration structure to speed up the triangle-ray
-/// intersection tests, but this is currently not the case.
+/// meshes into the recorders. To speed up the triangle-ray intersection tests
+/// a bounding volume hierarchy is built over the combined mesh of the scene.
 class Scene {
 private:
+	boost::mutex statistics_mutex;
 	/// Intersects the ray in sound_ray with the triangles of the scene's meshes.
 	/// In case no hit is found (for example between there is no geometry in that
-	/// direction) 0 is returned. The arguments that are passed by reference return
-	/// information about the triangle normal on which the ray is reflected, the
-	/// path length of the previous origin to the point of intersection, the material
-	/// at the hit point and the type of bounce which is to be processed, meaning
-	/// whether the ray is reflected or refracted (through a transparent material)
-	inline gmtl::Rayf* Bounce(int band, gmtl::Rayf* sound_ray, gmtl::Vec3f*& surface_normal, float& l, Material*& mat, BounceType& bt);
+	/// direction) false is returned. Otherwise sound_ray is replaced by the ray
+	/// that continues from the point of intersection. The arguments that are passed
+	/// by reference return information about the triangle normal on which the ray
+	/// is reflected, the path length of the previous origin to the point of
+	/// intersection, the material at the hit point and the type of bounce which is
+	/// to be processed, meaning whether the ray is reflected or refracted (through
+	/// a transparent material)
+	inline bool Bounce(int band, Sampler& sampler, gmtl::Rayf& sound_ray, gmtl::Vec3f& surface_normal, float& l, Material*& mat, BounceType& bt);
 	/// Sees whether there is a free line of sight between the point p and point x.
-	/// This is done by testing all triangles in the scene for intersection with the
-	/// line segment between p and x until an intersection is found. So this is a
-	/// timeconsuming operation that could be sped up by using a grid acceleration
-	/// structure
-	inline gmtl::LineSegf* Connect(const gmtl::Point3f* p, const gmtl::Point3f& x);
+	/// This is done by traversing the bounding volume hierarchy of the scene for
+	/// triangles intersecting the line segment between p and x until the first
+	/// blocking triangle is found. Note that this is the most frequent geometry
+	/// query, as it is issued for every bounce for every recorder.
+	inline bool Connect(const gmtl::Point3f& p, const gmtl::Point3f& x);
+	/// Samples the direction v in which a ray travelling in direction dir is
+	/// scattered by the surface with material mat and normal surface_normal.
+	/// The type of bounce is returned in bt, in case of a refraction the
+	/// surface normal is flipped.
+	inline void Scatter(int band, Sampler& sampler, const gmtl::Vec3f& dir, Material* mat, gmtl::Vec3f& surface_normal, BounceType& bt, gmtl::Vec3f& v);
+	/// Returns the intensity with which the vertex of a path contributes to a
+	/// recorder, visible from the vertex in direction lsdir at distance l. The
+	/// intensity is zero in case the recorder is behind the surface.
+	inline float Contribution(int band, int num_bounces, BounceType bt, float spec_coef, const gmtl::Vec3f* surface_normal, const gmtl::Vec3f& prev_ray_dir, const gmtl::Vec3f& lsdir, float l, float intensity, float absorbtion_factor);
+	/// Decides whether a path is continued after its last vertex has been
+	/// connected to the recorders. Paths of which the intensity drops below
+	/// roulette_threshold are terminated by Russian roulette, with a
+	/// probability that increases as the intensity decreases. The intensity
+	/// of the paths that survive is raised by the inverse of that
+	/// probability, so that the expected energy is unchanged.
+	inline bool Continue(Sampler& sampler, float& intensity);
+	/// Returns whether the arrival time of a path of length l falls within
+	/// the impulse response, see max_ir_length.
+	inline bool WithinResponse(float l) const;
+	/// The locations of the recorders for a keyframe as separate arrays of
+	/// coordinates, padded to a multiple of MAX_PACKET_SIZE, so that the
+	/// contributions to multiple recorders can be evaluated using SIMD.
+	struct RecorderLocations {
+		std::vector<float> x, y, z;
+		RecorderLocations(const std::vector<Recorder*>& recs, int keyframeID);
+	};
+	/// Connects the vertex p of a path of length path_length to all recorders
+	/// at once. The contributions to the recorders are evaluated together
+	/// first, see Contribution(), after which the line segments to the
+	/// recorders that receive a contribution are tested for occlusion as
+	/// packets that share the vertex. The contributions are also added to
+	/// convergence, unless it is null.
+	void ConnectVertex(int band, int num_bounces, BounceType bt, float spec_coef, const gmtl::Vec3f& surface_normal, const gmtl::Vec3f& prev_ray_dir, const gmtl::Point3f& p, float path_length, float intensity, float absorbtion_factor, const std::vector<Recorder*>& recs, const RecorderLocations& locations, int keyframeID, Convergence* convergence, boost::uint64_t& shadow_rays);
+	/// The state of a path that is traced by the packet and wavefront engines,
+	/// which advance many paths bounce by bounce rather than one at a time.
+	/// The ray originates at the last vertex of the path.
+	struct Path {
+		gmtl::Rayf ray;
+		gmtl::Vec3f surface_normal;
+		gmtl::Vec3f prev_ray_dir;
+		Material* mat;
+		BounceType bt;
+		float intensity;
+		float length;
+		int bounces;
+		/// The number of the path and the dimensions drawn from the sampler
+		boost::uint32_t sample_index;
+		int sample_dimension;
+	};
+	/// Emits count new paths from the sound source, numbered from
+	/// first_sample onwards.
+	void EmitPaths(AbstractSoundFile* sound, Sampler& sampler, int keyframeID, int first_sample, Path* paths, int count);
+	/// Traces the rays of the paths to the next surface, in packets of
+	/// packet_size rays, and samples the direction in which they are scattered.
+	/// Paths that leave the scene or lose all energy are removed. Returns the
+	/// number of remaining paths, which are compacted to the front of paths.
+	int ExtendPaths(int band, Sampler& sampler, float absorbtion_factor, Path* paths, int count, boost::uint64_t& rays);
+	/// Connects the last vertex of the paths to the recorders and records the
+	/// contributions of the paths that have a free line of sight.
+	void ConnectPaths(int band, float absorbtion_factor, const Path* paths, int count, bool mesh_source, const std::vector<Recorder*>& recs, int keyframeID, Convergence* convergence, boost::uint64_t& shadow_rays);
+	/// Removes the paths that are terminated by Continue() or that have
+	/// reached the maximum number of bounces. Returns the number of remaining
+	/// paths, which are compacted to the front of paths.
+	int TerminatePaths(Sampler& sampler, Path* paths, int count);
+	/// Traces the paths of Trace() numbered from first_sample up to, but not
+	/// including, end_sample one at a time, following every path until it
+	/// terminates.
+	void TraceDepthFirst(int band, Sampler& sampler, AbstractSoundFile* sound, float absorbtion_factor, int first_sample, int end_sample, const std::vector<Recorder*>& recs, const RecorderLocations& locations, int keyframeID, Convergence* convergence, boost::uint64_t& rays, boost::uint64_t& shadow_rays);
+	/// Traces the paths of Trace() in packets of packet_size paths, which are
+	/// advanced bounce by bounce simultaneously. The rays and shadow rays of
+	/// the paths in a packet are traced through the hierarchy together.
+	void TracePackets(int band, Sampler& sampler, AbstractSoundFile* sound, float absorbtion_factor, int first_sample, int end_sample, const std::vector<Recorder*>& recs, int keyframeID, Convergence* convergence, boost::uint64_t& rays, boost::uint64_t& shadow_rays);
+	/// Traces the paths of Trace() breadth-first. A pool of wavefront_size
+	/// paths is advanced one bounce at a time in stages: the vertices of all
+	/// paths are connected to the recorders, terminated paths are removed,
+	/// the remaining paths are sorted by the direction and origin of their
+	/// rays and these rays are traced in packets to the next surface. The
+	/// pool is refilled with new paths until all samples have been emitted.
+	void TraceWavefront(int band, Sampler& sampler, AbstractSoundFile* sound, float absorbtion_factor, int first_sample, int end_sample, const std::vector<Recorder*>& recs, int keyframeID, Convergence* convergence, boost::uint64_t& rays, boost::uint64_t& shadow_rays);
 public:
 	std::vector<Recorder*> listeners;
 	std::vector<AbstractSoundFile*> sources;
 	std::vector<Mesh*> meshes;
+	/// The number of rays and shadow rays traced by all calls to Trace(),
+	/// used to report the throughput of the renderer.
+	boost::uint64_t rays_traced;
+	boost::uint64_t shadow_rays_traced;
+	/// The number of paths traced together as a packet by Trace(), at most
+	/// MAX_PACKET_SIZE. Zero or one means paths are traced one by one.
+	int packet_size;
+	/// The number of paths in flight when rendering breadth-first, see
+	/// TraceWavefront(). Zero means paths are traced depth-first.
+	int wavefront_size;
+	/// Whether the paths are sampled with quasi random numbers, see Sampler.
+	bool quasi_random;
+	/// The intensity below which paths are subject to Russian roulette, see
+	/// Continue(). Zero disables Russian roulette, paths are then terminated
+	/// once their intensity becomes negligible.
+	float roulette_threshold;
+	/// The length of the impulse responses in seconds. Paths are terminated
+	/// once their arrival time exceeds it. Zero means the length is not
+	/// limited.
+	float max_ir_length;
+	/// The relative error at which rendering stops tracing paths, see
+	/// Convergence and SceneContext. Zero means all samples are traced.
+	float target_error;
+	/// The directory in which the partial impulse responses are periodically
+	/// stored, see Checkpoint. Empty means no checkpoints are written.
+	std::string checkpoint_dir;
+	/// The number of seconds between two checkpoints. A checkpoint is also
+	/// written once rendering is finished.
+	float checkpoint_interval;
+	/// Whether rendering continues from the checkpoints in checkpoint_dir.
+	/// Renders that were finished can be refined by raising the number of
+	/// samples.
+	bool resume;
+	Scene();
 	/// Adds a listener to the scene.
 	void addListener(Recorder* l);
 	/// Adds a sound source to the scene.
@@ -68,13 +187,40 @@ public:
 	void addMesh(Mesh* m);
 	/// Adds a material definition to the scene.
 	void addMaterial(Material* m);
-	/// Renders an impulse response for the sound file in sound (an index in the
-	/// sources vector) for the frequency band specified in band. Multiple recorders
-	/// are supported to be rendered simultaneously in which case for every ray-triangle
-	/// intersection a connection is sought between the intersection point and
-	/// every recorder location. This is more efficient than rendering each recorder
-	/// separately, but does come for free either.
-	void Render(int band, int sound, float absorbtion_factor, int num_samples, float dry, const std::vector<Recorder*>& rec, int keyframeID = -1);
+	/// Prepares the meshes in the scene for intersection tests and unless
+	/// build_hierarchy is false builds the acceleration structure over them.
+	/// This needs to be called after all meshes have been added. The hierarchy
+	/// is cached in cache_dir, unless it is empty. The compact variants of the
+	/// hierarchy and triangles reduce the memory used for large models, see
+	/// Mesh::Prepare().
+	void Prepare(bool build_hierarchy = true, const std::string& cache_dir = "", bool compact_nodes = false, bool compact_triangles = false);
+	/// Returns the number of paths that are traced together as a batch, when
+	/// the paths of an impulse response of num_samples paths are divided
+	/// over multiple calls to Trace().
+	int BatchSize(int num_samples) const;
+	/// Returns the number of samples the recorders are expected to hold,
+	/// which follows from the maximum length of the paths, see
+	/// max_ir_length, or zero in case the length is not limited.
+	unsigned int ResponseLength() const;
+	/// Traces the paths numbered from first_sample up to, but not including,
+	/// end_sample of the impulse response for the sound file in sound (an index
+	/// in the sources vector) for the frequency band specified in band. Multiple
+	/// recorders are supported to be rendered simultaneously in which case for
+	/// every ray-triangle intersection a connection is sought between the
+	/// intersection point and every recorder location. This is more efficient
+	/// than rendering each recorder separately, but does come for free either.
+	/// The random numbers used to sample the paths are generated from seed and
+	/// first_sample, so that the same seed gives the same impulse response, as
+	/// long as the paths are divided in the same way. The contributions are added
+	/// to recs as they are, see Finish(), and to convergence, unless it is null.
+	/// The logs of recs are flushed and released before returning, see
+	/// Recorder::Flush(). Trace() can be called by multiple threads
+	/// simultaneously for different recorders.
+	void Trace(int band, int sound, float absorbtion_factor, int first_sample, int end_sample, const std::vector<Recorder*>& recs, int keyframeID = -1, boost::uint64_t seed = 0, Convergence* convergence = 0);
+	/// Completes the impulse responses in recs once all num_samples paths are
+	/// traced: the contributions are averaged over the paths and the direct
+	/// sound is added.
+	void Finish(int band, int sound, float absorbtion_factor, int num_samples, float dry, const std::vector<Recorder*>& recs, int keyframeID = -1);
 	~Scene();
 };
 
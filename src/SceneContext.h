@@ -21,8 +21,8 @@
 #include "SoundFile.h"
 
 /// This class holds all data that is needed to render an impulse response.
-/// The class is executable and can therefore be used as a context for a
-/// thread.
+/// The paths of the impulse response are traced by the chunks of a
+/// RenderTask.
 class SceneContext {
 public:
 	std::vector<Recorder*> recorders;
@@ -33,19 +33,27 @@ public:
 	int samples;
 	float absorption;
 	float dry_level;
+	/// The seed of the random numbers used to render this context, derived
+	/// from the global seed, so that a render does not depend on the order
+	/// in which the contexts are executed by the threads.
+	boost::uint64_t seed;
+	/// The number of paths that were traced and the relative error of the
+	/// impulse response, which are only known after rendering in case the
+	/// scene renders adaptively, see Scene::target_error.
+	int samples_traced;
+	float error;
 	void assignRecorders(Scene* s) {
 		for ( std::vector<Recorder*>::const_iterator it = s->listeners.begin(); it != s->listeners.end(); ++ it ) {
-			recorders.push_back((*it)->getBlankCopy(4));
+			recorders.push_back((*it)->getBlankCopy(s->ResponseLength()));
 		}
 	}
-	SceneContext(Scene* scn,int b,int sf, int s, float ab, float dr, int kf=-1) :
+	SceneContext(Scene* scn,int b,int sf, int s, float ab, float dr, int kf=-1, boost::uint64_t global_seed=0) :
 			scene(scn), band(b), soundfile_id(sf), keyframe_id(kf),
-			samples(s), absorption(ab), dry_level(dr) {
+			samples(s), absorption(ab), dry_level(dr),
+			seed(RandomGenerator::DeriveSeed(global_seed,sf,kf,b)),
+			samples_traced(0), error(0.0f) {
 		assignRecorders(scn);
 	}
-	void operator()() {		
-		scene->Render(band,soundfile_id,absorption,samples,dry_level,recorders,keyframe_id);
-	}
 	std::string toString() const {
 		std::stringstream ss;
 		ss << "s:" << soundfile_id << " b:" << band << " k:" << keyframe_id;
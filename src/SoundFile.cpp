@@ -50,6 +50,7 @@ SoundFile::SoundFile() {
 	} else if ( Datatype::PeakId() == "mesh" ) {
 		Datatype::prefix = " +- " + Datatype::prefix;
 		mesh = new Mesh();
+		mesh->PrepareSampling();
 		Datatype::prefix = Datatype::prefix.substr(4);
 	} else {
 		setLocation(ReadPoint());			
@@ -97,6 +98,7 @@ TripleBandSoundFile::TripleBandSoundFile() {
 	} else if ( Datatype::PeakId() == "mesh" ) {
 		Datatype::prefix = " +- " + Datatype::prefix;
 		mesh = new Mesh();
+		mesh->PrepareSampling();
 		Datatype::prefix = Datatype::prefix.substr(4);
 	} else {
 		setLocation(ReadPoint());			
@@ -212,18 +214,21 @@ std::string TripleBandSoundFile::toString() {
 	return ss.str();
 }
 
-gmtl::Rayf* AbstractSoundFile::SoundRay(int keyframeID) {
+gmtl::Rayf AbstractSoundFile::SoundRay(Sampler& sampler, int keyframeID) {
+	float u1, u2;
 	if ( mesh > 0 ) {
 		gmtl::Point3f p;
 		gmtl::Vec3f n,d;
-		mesh->SamplePoint(p,n);
-		Sample_Hemi(d,n);
-		return new gmtl::Rayf(p,d);			
+		mesh->SamplePoint(p,n,sampler);
+		sampler.Get2D(u1,u2);
+		Sample_Hemi(d,n,u1,u2);
+		return gmtl::Rayf(p,d);
 	} else {
 		gmtl::Point3f p = getLocation(keyframeID);
 		gmtl::Vec3f d;
-		Sample_Sphere(d);
-		return new gmtl::Rayf(p,d);
+		sampler.Get2D(u1,u2);
+		Sample_Sphere(d,u1,u2);
+		return gmtl::Rayf(p,d);
 	}
 }
 
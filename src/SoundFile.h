@@ -53,7 +53,9 @@ public:
 	gmtl::Point3f getLocation();
 	gmtl::Point3f getLocation(int i);
 	
-	gmtl::Rayf* SoundRay(int keyframeID = -1);
+	/// Returns a ray emitted by the sound source in a random direction, from
+	/// a random point on the mesh in case the sound source emits from a mesh.
+	gmtl::Rayf SoundRay(Sampler& sampler, int keyframeID = -1);
 	bool isMeshSource();
 	float getGain();
 
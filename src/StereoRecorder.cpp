@@ -30,7 +30,7 @@ std::string StereoRecorder::getFilename() { return filename; }
 void StereoRecorder::setFilename(const std::string& s) { filename = s; }
 int StereoRecorder::trackCount() { return 2; }
 
-StereoRecorder::StereoRecorder(bool fromFile) {
+StereoRecorder::StereoRecorder(bool fromFile, unsigned int reserve) {
 	is_truncated = is_processed = false;
 	if ( fromFile ) {
 		stamped_offset = 0;
@@ -62,11 +62,11 @@ StereoRecorder::StereoRecorder(bool fromFile) {
 		filename = "";
 	}
 	has_samples = save_processed = false;
-	tracks.push_back(new RecorderTrack());
-	tracks.push_back(new RecorderTrack());
+	tracks.push_back(new RecorderTrack(reserve));
+	tracks.push_back(new RecorderTrack(reserve));
 }
-Recorder* StereoRecorder::getBlankCopy(int secs) {
-	StereoRecorder* r = new StereoRecorder(false);
+Recorder* StereoRecorder::getBlankCopy(unsigned int reserve) {
+	StereoRecorder* r = new StereoRecorder(false,reserve);
 	r->stamped_offset = 0;
 	r->filename = filename;
 	r->location = location;
@@ -82,27 +82,26 @@ bool StereoRecorder::Save(const std::string& fn, bool norm, float norm_max) {
 	WaveFile w;
 	const RecorderTrack& left  = *(save_processed ? processed_tracks[0] : tracks[0]);
 	const RecorderTrack& right = *(save_processed ? processed_tracks[1] : tracks[1]);
-	w.FromFloat(&left[0],&right[0],left.getLength(),right.getLength(),norm);
+	// The samples are stored in pages, which are copied to contiguous arrays
+	std::vector<float> left_samples(left.getLength()+1), right_samples(right.getLength()+1);
+	left.CopyTo(&left_samples[0],0,left_samples.size());
+	right.CopyTo(&right_samples[0],0,right_samples.size());
+	w.FromFloat(&left_samples[0],&right_samples[0],left.getLength(),right.getLength(),norm);
 	w.Save(fn.c_str());
 	return true;
 }
 bool StereoRecorder::Save() {
 	return Save(filename,false);
 }
-inline void StereoRecorder::_Sample(int i, float v, int channel) {
-	if ( i < 0 ) return;
-	this->tracks[channel]->operator [](i) += v;
-	has_samples = true;
-}
-void StereoRecorder::Record(const gmtl::Vec3f& dir, float a, float t, float dist, int band, int kf) {
-	const float dot = gmtl::dot(dir,getRightEar(kf));
+void StereoRecorder::Splat(const Contribution& c) {
+	const float dot = gmtl::dot(c.dir,getRightEar(c.kf));
 	const float time_difference = head_size / 343.0f;
 
-	const int s_right = (int) ((t-(dot*time_difference))*44100.0);
-	const int s_left = (int) ((t+(dot*time_difference))*44100.0);
+	const int s_right = (int) ((c.t-(dot*time_difference))*44100.0);
+	const int s_left = (int) ((c.t+(dot*time_difference))*44100.0);
 
-	const float width = sqrt(dist);
-	const float ampl = 2.0f * a / width;
+	const float width = sqrt(c.dist);
+	const float ampl = 2.0f * c.ampl / width;
 	
 	float ampl_left = ampl;
 	float ampl_right = ampl;
@@ -110,7 +109,7 @@ void StereoRecorder::Record(const gmtl::Vec3f& dir, float a, float t, float dist
 	const float intensity_difference = fabs(dot);
 
 	// Interaural intensity differences are higher for the high frequency bands
-	const float factor = powf(head_absorption[band],intensity_difference*head_size);
+	const float factor = powf(head_absorption[c.band],intensity_difference*head_size);
 	if ( dot < 0 ) {
 		ampl_right *= factor*factor;
 	} else {
@@ -121,12 +120,9 @@ void StereoRecorder::Record(const gmtl::Vec3f& dir, float a, float t, float dist
 	const float step_left = ampl_left / w;
 	const float step_right = ampl_right / w;
 
-	for ( int i = 0; i < w; ++ i ) {
-		_Sample(i+s_left,ampl_left,0);
-		ampl_left -= step_left;
-		_Sample(i+s_right,ampl_right,1);
-		ampl_right -= step_right;
-	}
+	tracks[0]->Splat(s_left,w,ampl_left,step_left);
+	tracks[1]->Splat(s_right,w,ampl_right,step_right);
+	has_samples = true;
 }
 void StereoRecorder::setLocation(gmtl::Point3f p) {
 	location = p;
@@ -53,12 +53,12 @@ public:
 	void setFilename(const std::string& s);
 	int trackCount();
 	
-	StereoRecorder(bool fromFile = true);
-	Recorder* getBlankCopy(int secs = -1);
+	/// Reads the recorder from the file in case fromFile is set. The tracks
+	/// reserve room for the number of samples in reserve, see FloatBuffer.
+	StereoRecorder(bool fromFile = true, unsigned int reserve = 0);
+	Recorder* getBlankCopy(unsigned int reserve = 0);
 	bool Save(const std::string& fn, bool norm = true, float norm_max = 1.0f);
 	bool Save();
-	inline void _Sample(int i, float v, int channel);
-	void Record(const gmtl::Vec3f& dir, float ampl, float t, float dist, int band, int kf);
 	void setLocation(gmtl::Point3f p);
 	bool isAnimated();
 	const gmtl::Point3f& getLocation(int i=-1) const;
@@ -66,6 +66,8 @@ public:
 	float getSegmentLength(int i);
 	std::string toString();
 	Animated<gmtl::Point3f>* getAnimationData();
+protected:
+	void Splat(const Contribution& c);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int thread_count) : generation(0), pending(0), stopping(false), failed(false) {
+	if ( thread_count <= 0 ) thread_count = (int) boost::thread::hardware_concurrency();
+	if ( thread_count <= 0 ) thread_count = 1;
+	for ( int i = 0; i < thread_count; ++ i ) {
+		queues.push_back(new Queue());
+	}
+	for ( int i = 0; i < thread_count; ++ i ) {
+		threads.create_thread(boost::bind(&ThreadPool::Work,this,i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{boost::mutex::scoped_lock lock(mutex);
+	stopping = true;}
+	work_available.notify_all();
+	threads.join_all();
+	for ( std::vector<Queue*>::const_iterator it = queues.begin(); it != queues.end(); ++ it ) {
+		delete *it;
+	}
+}
+
+void ThreadPool::Run(const std::vector<Task>& tasks) {
+	if ( tasks.empty() ) return;
+	// The number of pending tasks is set before the tasks are queued, as
+	// workers that are still looking for work can start them right away.
+	{boost::mutex::scoped_lock lock(mutex);
+	pending = (int) tasks.size();
+	failed = false;
+	error.clear();}
+	const int n = threadCount();
+	for ( unsigned int i = 0; i < tasks.size(); ++ i ) {
+		Queue* queue = queues[i % n];
+		boost::mutex::scoped_lock lock(queue->mutex);
+		queue->tasks.push_back(tasks[i]);
+	}
+	boost::mutex::scoped_lock lock(mutex);
+	generation ++;
+	work_available.notify_all();
+	while ( pending ) work_done.wait(lock);
+	if ( failed ) throw std::runtime_error(error.empty() ? "A task failed" : error);
+}
+
+bool ThreadPool::Take(int worker, Task& task) {
+	const int n = threadCount();
+	for ( int i = 0; i < n; ++ i ) {
+		Queue* queue = queues[(worker + i) % n];
+		boost::mutex::scoped_lock lock(queue->mutex);
+		if ( queue->tasks.empty() ) continue;
+		task = queue->tasks.front();
+		queue->tasks.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::Work(int worker) {
+	int seen = 0;
+	while ( true ) {
+		{boost::mutex::scoped_lock lock(mutex);
+		while ( !stopping && generation == seen ) work_available.wait(lock);
+		if ( stopping ) return;
+		seen = generation;}
+
+		Task task;
+		while ( Take(worker,task) ) {
+			// An exception is passed on to the caller of Run()
+			bool task_failed = false;
+			std::string message;
+			try {
+				task(worker);
+			} catch ( std::exception& e ) {
+				task_failed = true;
+				message = e.what();
+			} catch ( ... ) {
+				task_failed = true;
+				message = "Unknown exception in task";
+			}
+			boost::mutex::scoped_lock lock(mutex);
+			if ( task_failed && !failed ) {
+				failed = true;
+				error = message;
+			}
+			if ( -- pending == 0 ) work_done.notify_all();
+		}
+	}
+}
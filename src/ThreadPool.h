@@ -0,0 +1,80 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/// A fixed set of worker threads that execute lists of tasks. The threads
+/// are created once and wait in between the calls to Run(). The tasks are
+/// dealt to the workers in order, every worker executes the tasks from the
+/// front of its own queue and, once that is empty, steals tasks from the
+/// front of the queues of the other workers, so that all workers stay busy
+/// until the last task is started, regardless of how long the individual
+/// tasks take.
+class ThreadPool {
+public:
+	/// A task is passed the index of the worker that executes it, in the
+	/// range [0,threadCount()), so that tasks can use memory private to
+	/// that worker.
+	typedef boost::function<void (int)> Task;
+private:
+	struct Queue {
+		boost::mutex mutex;
+		std::deque<Task> tasks;
+	};
+	std::vector<Queue*> queues;
+	boost::thread_group threads;
+	boost::mutex mutex;
+	boost::condition_variable work_available;
+	boost::condition_variable work_done;
+	int generation;
+	int pending;
+	bool stopping;
+	/// Whether a task of the current Run() has thrown an exception, and the
+	/// message of the first one
+	bool failed;
+	std::string error;
+	/// Takes the next task of worker, from its own queue or another one.
+	bool Take(int worker, Task& task);
+	void Work(int worker);
+public:
+	/// Creates a pool of the specified number of threads. Zero or less
+	/// creates a thread for every hardware thread of the machine.
+	ThreadPool(int thread_count = 0);
+	/// Executes the tasks on the threads of the pool and returns once all
+	/// tasks are finished. In case a task throws an exception, the other
+	/// tasks are still executed, after which the message of the first
+	/// exception is thrown as a std::runtime_error. Exceptions that are not
+	/// derived from std::exception are reported as well.
+	void Run(const std::vector<Task>& tasks);
+	/// Returns the number of threads in the pool
+	int threadCount() const { return (int) queues.size(); }
+	~ThreadPool();
+};
+
+#endif
@@ -41,10 +41,8 @@ Triangle::Triangle() : gmtl::Trif() {
 	normal = gmtl::normal(*this);
 	calcArea();
 }
-void Triangle::SamplePoint(gmtl::Point3f& P) {
+void Triangle::SamplePoint(gmtl::Point3f& P, float r1, float r2) {
 	// http://math.stackexchange.com/questions/18686/uniform-random-point-in-triangle
-	const float r1 = gmtl::Math::unitRandom();
-	const float r2 = gmtl::Math::unitRandom();
 	const float sr1 = gmtl::Math::sqrt(r1);
 	const gmtl::Point3f& A = (*this)[0];
 	const gmtl::Point3f& B = (*this)[1];
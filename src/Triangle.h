@@ -38,7 +38,7 @@ public:
 	Material* m;
 	Triangle(const gmtl::Point3f& a,const gmtl::Point3f& b,const gmtl::Point3f& c);
 	Triangle();
-	void SamplePoint(gmtl::Point3f& p);
+	void SamplePoint(gmtl::Point3f& p, float u1, float u2);
 	float SignedVolume() const;
 };
 
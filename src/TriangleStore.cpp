@@ -0,0 +1,233 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <vector>
+#include <map>
+#include <string.h>
+
+#include "HelperFunctions.h"
+#include "SIMD.h"
+#include "TriangleStore.h"
+
+// The number of float arrays in the store: vertex0, edge1, edge2 and normal
+#define STORE_ARRAYS 12
+
+namespace {
+
+	// Intersects a ray with the group of triangles starting at index i,
+	// which needs to be a multiple of the number of lanes. The operations
+	// are performed in the same order as TriangleStore::Intersect() and the
+	// comparisons are negated rather than inverted, so that also for NaNs
+	// every lane produces exactly the same result as the scalar code.
+	// Returns a mask of the lanes in which the triangle is hit.
+	template <typename L>
+	inline typename L::type IntersectLanes(const TriangleStore& s, unsigned int i, const typename L::type* o, const typename L::type* d, typename L::type& t) {
+		typedef typename L::type T;
+		const T e1x = L::load(s.edge1[0]+i), e1y = L::load(s.edge1[1]+i), e1z = L::load(s.edge1[2]+i);
+		const T e2x = L::load(s.edge2[0]+i), e2y = L::load(s.edge2[1]+i), e2z = L::load(s.edge2[2]+i);
+		const T px = L::sub(L::mul(d[1],e2z),L::mul(d[2],e2y));
+		const T py = L::sub(L::mul(d[2],e2x),L::mul(d[0],e2z));
+		const T pz = L::sub(L::mul(d[0],e2y),L::mul(d[1],e2x));
+		const T det = L::add(L::add(L::mul(e1x,px),L::mul(e1y,py)),L::mul(e1z,pz));
+		T valid = L::either(L::ngt(det,L::set(-TRIANGLE_EPSILON)),L::nlt(det,L::set(TRIANGLE_EPSILON)));
+		const T inv_det = L::div(L::set(1.0f),det);
+		const T tx = L::sub(o[0],L::load(s.vertex0[0]+i));
+		const T ty = L::sub(o[1],L::load(s.vertex0[1]+i));
+		const T tz = L::sub(o[2],L::load(s.vertex0[2]+i));
+		const T u = L::mul(L::add(L::add(L::mul(tx,px),L::mul(ty,py)),L::mul(tz,pz)),inv_det);
+		valid = L::both(valid,L::both(L::nlt(u,L::set(0.0f)),L::ngt(u,L::set(1.0f))));
+		const T qx = L::sub(L::mul(ty,e1z),L::mul(tz,e1y));
+		const T qy = L::sub(L::mul(tz,e1x),L::mul(tx,e1z));
+		const T qz = L::sub(L::mul(tx,e1y),L::mul(ty,e1x));
+		const T v = L::mul(L::add(L::add(L::mul(d[0],qx),L::mul(d[1],qy)),L::mul(d[2],qz)),inv_det);
+		valid = L::both(valid,L::both(L::nlt(v,L::set(0.0f)),L::ngt(L::add(u,v),L::set(1.0f))));
+		t = L::mul(L::add(L::add(L::mul(e2x,qx),L::mul(e2y,qy)),L::mul(e2z,qz)),inv_det);
+		return valid;
+	}
+
+	// Returns a bit mask of the lanes of the group starting at index i that
+	// fall within the range [begin,end).
+	template <typename L>
+	inline int RangeMask(unsigned int i, unsigned int begin, unsigned int end) {
+		int m = (1 << L::width) - 1;
+		if ( i < begin ) m &= ~((1 << (begin - i)) - 1);
+		if ( end - i < (unsigned int) L::width ) m &= (1 << (end - i)) - 1;
+		return m;
+	}
+
+	template <typename L>
+	bool RayIntersectionLanes(const TriangleStore& s, const gmtl::Rayf& r, unsigned int begin, unsigned int end, float& t, unsigned int& index) {
+		typedef typename L::type T;
+		const T o[3] = {L::set(r.mOrigin[0]),L::set(r.mOrigin[1]),L::set(r.mOrigin[2])};
+		const T d[3] = {L::set(r.mDir[0]),L::set(r.mDir[1]),L::set(r.mDir[2])};
+		const T min_dist = L::set(0.001f);
+		bool hit = false;
+		for ( unsigned int i = begin - begin % L::width; i < end; i += L::width ) {
+			T dist;
+			const T valid = IntersectLanes<L>(s,i,o,d,dist);
+			const int m = L::mask(L::both(valid,L::both(L::gt(dist,min_dist),L::lt(dist,L::set(t))))) & RangeMask<L>(i,begin,end);
+			if ( !m ) continue;
+			// Resolve the hits in the group in order of increasing index, so
+			// that for equal distances the same triangle is returned as by a
+			// sequential scan.
+			float dists[L::width];
+			L::store(dists,dist);
+			for ( int j = 0; j < L::width; ++ j ) {
+				if ( (m & (1 << j)) && dists[j] < t ) {
+					t = dists[j];
+					index = i + j;
+					hit = true;
+				}
+			}
+		}
+		return hit;
+	}
+
+	template <typename L>
+	bool LineIntersectionLanes(const TriangleStore& s, const gmtl::Rayf& r, unsigned int begin, unsigned int end) {
+		typedef typename L::type T;
+		const T o[3] = {L::set(r.mOrigin[0]),L::set(r.mOrigin[1]),L::set(r.mOrigin[2])};
+		const T d[3] = {L::set(r.mDir[0]),L::set(r.mDir[1]),L::set(r.mDir[2])};
+		const T min_dist = L::set(1e-5f);
+		const T max_dist = L::set(1.0f);
+		for ( unsigned int i = begin - begin % L::width; i < end; i += L::width ) {
+			T dist;
+			const T valid = IntersectLanes<L>(s,i,o,d,dist);
+			if ( L::mask(L::both(valid,L::both(L::gt(dist,min_dist),L::lt(dist,max_dist)))) & RangeMask<L>(i,begin,end) ) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+}
+
+TriangleStore::TriangleStore(const std::vector<Triangle*>& tris, bool store_normals) {
+	count = (unsigned int) tris.size();
+	padded_count = (count + 7) & ~7u;
+	if ( !padded_count ) padded_count = 8;
+
+	// All arrays are allocated as a single block. Because the padded count
+	// is a multiple of eight and hence every array a multiple of 32 bytes,
+	// every array is aligned to at least 32 bytes.
+	block_size = byteSize(count,store_normals);
+	block = AlignedMalloc(block_size);
+	memset(block,0,block_size);
+	float* f = (float*) block;
+	for ( int i = 0; i < 3; ++ i ) {
+		vertex0[i] = f; f += padded_count;
+		edge1[i]   = f; f += padded_count;
+		edge2[i]   = f; f += padded_count;
+		if ( store_normals ) {
+			normal[i] = f; f += padded_count;
+		} else {
+			normal[i] = 0;
+		}
+	}
+	material = (unsigned short*) f;
+
+	std::map<Material*,unsigned short> material_index;
+	for ( unsigned int i = 0; i < count; ++ i ) {
+		const Triangle& t = *tris[i];
+		for ( int j = 0; j < 3; ++ j ) {
+			vertex0[j][i] = t[0][j];
+			edge1[j][i] = t[1][j] - t[0][j];
+			edge2[j][i] = t[2][j] - t[0][j];
+			if ( store_normals ) normal[j][i] = t.normal[j];
+		}
+		std::map<Material*,unsigned short>::const_iterator it = material_index.find(t.m);
+		if ( it == material_index.end() ) {
+			const unsigned short m = (unsigned short) materials.size();
+			material_index[t.m] = m;
+			materials.push_back(t.m);
+			material[i] = m;
+		} else {
+			material[i] = it->second;
+		}
+	}
+	if ( materials.empty() ) materials.push_back(0);
+}
+
+size_t TriangleStore::byteSize(unsigned int count, bool store_normals) {
+	unsigned int padded_count = (count + 7) & ~7u;
+	if ( !padded_count ) padded_count = 8;
+	const int arrays = store_normals ? STORE_ARRAYS : STORE_ARRAYS - 3;
+	return padded_count * (arrays * sizeof(float) + sizeof(unsigned short));
+}
+
+TriangleStore::~TriangleStore() {
+	AlignedFree(block);
+}
+
+bool TriangleStore::RayIntersection(const gmtl::Rayf& r, unsigned int begin, unsigned int end, float& t, unsigned int& index) const {
+#if defined(SIMD_AVX)
+	return RayIntersectionLanes<AVXLanes>(*this,r,begin,end,t,index);
+#elif defined(SIMD_SSE)
+	return RayIntersectionLanes<SSELanes>(*this,r,begin,end,t,index);
+#else
+	return RayIntersectionScalar(r,begin,end,t,index);
+#endif
+}
+
+bool TriangleStore::LineIntersection(const gmtl::Rayf& r, unsigned int begin, unsigned int end) const {
+#if defined(SIMD_AVX)
+	return LineIntersectionLanes<AVXLanes>(*this,r,begin,end);
+#elif defined(SIMD_SSE)
+	return LineIntersectionLanes<SSELanes>(*this,r,begin,end);
+#else
+	return LineIntersectionScalar(r,begin,end);
+#endif
+}
+
+bool TriangleStore::RayIntersectionScalar(const gmtl::Rayf& r, unsigned int begin, unsigned int end, float& t, unsigned int& index) const {
+	const float o[3] = {r.mOrigin[0],r.mOrigin[1],r.mOrigin[2]};
+	const float d[3] = {r.mDir[0],r.mDir[1],r.mDir[2]};
+	bool hit = false;
+	float dist;
+	for ( unsigned int i = begin; i < end; ++ i ) {
+		if ( Intersect(i,o,d,dist) && dist > 0.001f && dist < t ) {
+			t = dist;
+			index = i;
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+bool TriangleStore::LineIntersectionScalar(const gmtl::Rayf& r, unsigned int begin, unsigned int end) const {
+	const float o[3] = {r.mOrigin[0],r.mOrigin[1],r.mOrigin[2]};
+	const float d[3] = {r.mDir[0],r.mDir[1],r.mDir[2]};
+	float dist;
+	for ( unsigned int i = begin; i < end; ++ i ) {
+		if ( Intersect(i,o,d,dist) && dist > 1e-5f && dist < 1.0f ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* TriangleStore::getInstructionSet() {
+#if defined(SIMD_AVX)
+	return "AVX";
+#elif defined(SIMD_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,132 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef TRIANGLESTORE_H
+#define TRIANGLESTORE_H
+
+#include <vector>
+
+#include <gmtl/Vec.h>
+#include <gmtl/VecOps.h>
+#include <gmtl/Ray.h>
+
+#include "Triangle.h"
+#include "Material.h"
+
+// The determinant below which a ray is considered to lie in the plane of
+// a triangle, equal to the epsilon used by gmtl::intersectDoubleSided.
+#define TRIANGLE_EPSILON 0.00001f
+
+/// A compact copy of the triangles of a mesh, stored as a structure of
+/// arrays rather than an array of Triangle pointers. For every triangle the
+/// first vertex and the two edges that share this vertex are precomputed,
+/// which are the quantities needed by the Moller-Trumbore intersection
+/// test. All arrays are aligned to a cache line and padded to a multiple of
+/// eight triangles, so that an intersection loop streams through memory
+/// linearly. Padding triangles have no area and are never hit. For very
+/// large models the normals can be left out, in which case they are derived
+/// from the edges of a triangle when it is hit, which gives the same result.
+class TriangleStore {
+private:
+	void* block;
+	size_t block_size;
+	std::vector<Material*> materials;
+	unsigned int count;
+	unsigned int padded_count;
+public:
+	float* vertex0[3];
+	float* edge1[3];
+	float* edge2[3];
+	float* normal[3];
+	unsigned short* material;
+
+	/// Copies the triangles, in the order specified, into the store. Unless
+	/// store_normals is true, the normal arrays are null.
+	TriangleStore(const std::vector<Triangle*>& tris, bool store_normals = true);
+	~TriangleStore();
+	/// Returns the number of triangles in the store, excluding padding.
+	unsigned int size() const { return count; }
+	/// Returns the number of triangles in the store, including padding.
+	unsigned int paddedSize() const { return padded_count; }
+	/// Returns the number of bytes allocated for the triangles.
+	size_t byteSize() const { return block_size; }
+	/// Returns the number of bytes a store of count triangles allocates.
+	static size_t byteSize(unsigned int count, bool store_normals);
+	/// Returns the normal of the triangle at index i.
+	gmtl::Vec3f getNormal(unsigned int i) const {
+		if ( normal[0] ) return gmtl::Vec3f(normal[0][i],normal[1][i],normal[2][i]);
+		// The same operations as gmtl::normal() on the original triangle
+		gmtl::Vec3f n;
+		gmtl::cross(n,gmtl::Vec3f(edge1[0][i],edge1[1][i],edge1[2][i]),gmtl::Vec3f(edge2[0][i],edge2[1][i],edge2[2][i]));
+		gmtl::normalize(n);
+		return n;
+	}
+	/// Returns the material of the triangle at index i.
+	Material* getMaterial(unsigned int i) const {
+		return materials[material[i]];
+	}
+	/// Intersects a ray with the triangle at index i and returns the
+	/// parametric distance t along the ray. This is an exact equivalent
+	/// of gmtl::intersectDoubleSided() and gives identical results, but
+	/// operates on the precomputed edges in the store.
+	inline bool Intersect(unsigned int i, const float* o, const float* d, float& t) const {
+		const float e1x = edge1[0][i], e1y = edge1[1][i], e1z = edge1[2][i];
+		const float e2x = edge2[0][i], e2y = edge2[1][i], e2z = edge2[2][i];
+		const float px = d[1]*e2z - d[2]*e2y;
+		const float py = d[2]*e2x - d[0]*e2z;
+		const float pz = d[0]*e2y - d[1]*e2x;
+		const float det = e1x*px + e1y*py + e1z*pz;
+		if ( det > -TRIANGLE_EPSILON && det < TRIANGLE_EPSILON ) return false;
+		const float inv_det = 1.0f / det;
+		const float tx = o[0] - vertex0[0][i];
+		const float ty = o[1] - vertex0[1][i];
+		const float tz = o[2] - vertex0[2][i];
+		const float u = (tx*px + ty*py + tz*pz) * inv_det;
+		if ( u < 0.0f || u > 1.0f ) return false;
+		const float qx = ty*e1z - tz*e1y;
+		const float qy = tz*e1x - tx*e1z;
+		const float qz = tx*e1y - ty*e1x;
+		const float v = (d[0]*qx + d[1]*qy + d[2]*qz) * inv_det;
+		if ( v < 0.0f || u + v > 1.0f ) return false;
+		t = (e2x*qx + e2y*qy + e2z*qz) * inv_det;
+		return true;
+	}
+	/// Finds the nearest triangle in the range [begin,end) hit by the ray
+	/// for which the parametric distance lies within (0.001, t). On entry
+	/// t defines the maximum distance of the hit point. Depending on the
+	/// instruction set the compiler targets, four (SSE) or eight (AVX)
+	/// triangles are tested at once. The results are identical to those of
+	/// RayIntersectionScalar(), which requires that the compiler does not
+	/// contract multiplications and additions into fused operations.
+	bool RayIntersection(const gmtl::Rayf& r, unsigned int begin, unsigned int end, float& t, unsigned int& index) const;
+	/// Returns whether any triangle in the range [begin,end) is hit by the
+	/// ray within the parametric range (1e-5, 1). The ray is expected to
+	/// have an unnormalized direction spanning a line segment. Like
+	/// RayIntersection() this tests multiple triangles at once.
+	bool LineIntersection(const gmtl::Rayf& r, unsigned int begin, unsigned int end) const;
+	/// Equivalent of RayIntersection() testing a single triangle at a time.
+	bool RayIntersectionScalar(const gmtl::Rayf& r, unsigned int begin, unsigned int end, float& t, unsigned int& index) const;
+	/// Equivalent of LineIntersection() testing a single triangle at a time.
+	bool LineIntersectionScalar(const gmtl::Rayf& r, unsigned int begin, unsigned int end) const;
+	/// Returns the name of the instruction set used by RayIntersection()
+	/// and LineIntersection().
+	static const char* getInstructionSet();
+};
+
+#endif
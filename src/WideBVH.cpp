@@ -0,0 +1,327 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#include "SIMD.h"
+#include "WideBVH.h"
+
+// Every level of the hierarchy adds at most three entries to the stack and
+// the depth of the wide hierarchy does not exceed that of the binary one.
+#define TRAVERSAL_STACK_SIZE 384
+// The largest quantized coordinate
+#define QUANTIZATION_LEVELS 255
+
+namespace {
+	// An entry on the traversal stack: an interior node or the range of
+	// triangles of a leaf, with the distance at which the ray enters its
+	// bounding box.
+	struct StackItem {
+		unsigned int index;
+		unsigned int count;
+		float t;
+		StackItem() {}
+		StackItem(unsigned int i, unsigned int c, float d) : index(i), count(c), t(d) {}
+	};
+
+	inline float Area(const BVHNode& n) {
+		const float dx = n.max[0] - n.min[0];
+		const float dy = n.max[1] - n.min[1];
+		const float dz = n.max[2] - n.min[2];
+		return 2.0f * (dx*dy + dy*dz + dz*dx);
+	}
+
+	// Returns the coordinate of grid cell q along axis i of the node. The
+	// traversal performs exactly the same operations.
+	inline float Dequantize(const WideBVHNode& n, int i, int q) {
+		return n.origin[i] + (float) q * n.scale[i];
+	}
+
+	// Computes the reciprocal of the ray direction for the slab test, like
+	// the binary hierarchy does.
+	inline void PrepareRay(const gmtl::Rayf& r, float* o, float* inv) {
+		for ( int i = 0; i < 3; ++ i ) {
+			float d = r.mDir[i];
+			if ( fabs(d) < 1e-20f ) d = d < 0.0f ? -1e-20f : 1e-20f;
+			o[i] = r.mOrigin[i];
+			inv[i] = 1.0f / d;
+		}
+	}
+
+	// Returns a bit mask of the children of the node whose boxes the ray
+	// overlaps within (0,t) and the distance at which the ray enters them.
+#ifdef SIMD_SSE
+	inline int IntersectChildren(const WideBVHNode& n, const float* o, const float* inv, float t, float* tmin) {
+		typedef SSELanes L;
+		typedef L::type T;
+		T tnear = L::set(0.0f);
+		T tfar = L::set(t);
+		for ( int i = 0; i < 3; ++ i ) {
+			const T origin = L::set(n.origin[i]);
+			const T scale = L::set(n.scale[i]);
+			const T lo = L::add(origin,L::mul(L::bytes(n.qmin[i]),scale));
+			const T hi = L::add(origin,L::mul(L::bytes(n.qmax[i]),scale));
+			const T oi = L::set(o[i]);
+			const T invi = L::set(inv[i]);
+			const T t0 = L::mul(L::sub(lo,oi),invi);
+			const T t1 = L::mul(L::sub(hi,oi),invi);
+			tnear = L::max(tnear,L::min(t0,t1));
+			tfar = L::min(tfar,L::max(t0,t1));
+		}
+		L::store(tmin,tnear);
+		return L::mask(L::le(tnear,tfar)) & ((1 << n.children) - 1);
+	}
+#else
+	inline int IntersectChildren(const WideBVHNode& n, const float* o, const float* inv, float t, float* tmin) {
+		int mask = 0;
+		for ( int k = 0; k < n.children; ++ k ) {
+			float tnear = 0.0f;
+			float tfar = t;
+			for ( int i = 0; i < 3; ++ i ) {
+				float t0 = (Dequantize(n,i,n.qmin[i][k]) - o[i]) * inv[i];
+				float t1 = (Dequantize(n,i,n.qmax[i][k]) - o[i]) * inv[i];
+				if ( t0 > t1 ) std::swap(t0,t1);
+				if ( t0 > tnear ) tnear = t0;
+				if ( t1 < tfar ) tfar = t1;
+			}
+			tmin[k] = tnear;
+			if ( tnear <= tfar ) mask |= 1 << k;
+		}
+		return mask;
+	}
+#endif
+
+	// Converts the children of the node in mask to stack items, the items
+	// are returned in order of increasing distance.
+	inline int ChildItems(const WideBVHNode& n, int mask, const float* tmin, StackItem* items) {
+		int count = 0;
+		unsigned int interior = n.first_child;
+		unsigned int triangle = n.first_triangle;
+		for ( int k = 0; k < n.children; ++ k ) {
+			if ( mask & (1 << k) ) {
+				StackItem item = n.count[k]
+					? StackItem(triangle,n.count[k],tmin[k])
+					: StackItem(interior,0,tmin[k]);
+				int j = count ++;
+				for ( ; j > 0 && items[j-1].t > item.t; -- j ) {
+					items[j] = items[j-1];
+				}
+				items[j] = item;
+			}
+			if ( n.count[k] ) triangle += n.count[k];
+			else interior ++;
+		}
+		return count;
+	}
+}
+
+WideBVH::WideBVH(const BVH& bvh) {
+	depth = leaf_count = 0;
+	if ( !bvh.NodeCount() ) return;
+	triangles.reserve(bvh.getTriangles().size());
+	nodes.push_back(WideBVHNode());
+	Build(bvh,0,0,1);
+}
+
+void WideBVH::Build(const BVH& bvh, unsigned int node, unsigned int binary_node, int level) {
+	if ( level > depth ) depth = level;
+	const BVHNode* binary = bvh.getNodes();
+
+	// The children of the binary node become the children of the wide node,
+	// after which the interior child with the largest surface area, which
+	// is the most likely to be hit, is replaced by its own children until
+	// the node is full.
+	unsigned int children[WIDE_BVH_WIDTH];
+	int n = 0;
+	if ( binary[binary_node].count ) {
+		children[n++] = binary_node;
+	} else {
+		children[n++] = binary_node + 1;
+		children[n++] = binary[binary_node].offset;
+		while ( n < WIDE_BVH_WIDTH ) {
+			int largest = -1;
+			float largest_area = -1.0f;
+			for ( int k = 0; k < n; ++ k ) {
+				const BVHNode& c = binary[children[k]];
+				if ( !c.count && Area(c) > largest_area ) {
+					largest = k;
+					largest_area = Area(c);
+				}
+			}
+			if ( largest < 0 ) break;
+			const unsigned int c = children[largest];
+			children[largest] = c + 1;
+			children[n++] = binary[c].offset;
+		}
+	}
+
+	WideBVHNode w;
+	memset(&w,0,sizeof(w));
+	w.children = (unsigned char) n;
+	for ( int i = 0; i < 3; ++ i ) {
+		float lo = binary[children[0]].min[i];
+		float hi = binary[children[0]].max[i];
+		for ( int k = 1; k < n; ++ k ) {
+			lo = (std::min)(lo,binary[children[k]].min[i]);
+			hi = (std::max)(hi,binary[children[k]].max[i]);
+		}
+		w.origin[i] = lo;
+		w.scale[i] = (hi - lo) / QUANTIZATION_LEVELS;
+		// Rounding errors can leave the last grid cell just below the upper
+		// bound, in which case the grid is enlarged slightly.
+		while ( w.scale[i] > 0.0f && Dequantize(w,i,QUANTIZATION_LEVELS) < hi ) {
+			w.scale[i] += w.scale[i] * 1e-6f;
+		}
+		// The child boxes are rounded outwards to the grid
+		for ( int k = 0; k < n; ++ k ) {
+			const BVHNode& c = binary[children[k]];
+			int qmin = 0, qmax = 0;
+			if ( w.scale[i] > 0.0f ) {
+				qmin = (int) floor((c.min[i] - lo) / w.scale[i]);
+				qmax = (int) ceil((c.max[i] - lo) / w.scale[i]);
+				qmin = (std::max)(0,(std::min)(QUANTIZATION_LEVELS,qmin));
+				qmax = (std::max)(0,(std::min)(QUANTIZATION_LEVELS,qmax));
+				while ( qmin > 0 && Dequantize(w,i,qmin) > c.min[i] ) qmin --;
+				while ( qmax < QUANTIZATION_LEVELS && Dequantize(w,i,qmax) < c.max[i] ) qmax ++;
+			}
+			w.qmin[i][k] = (unsigned char) qmin;
+			w.qmax[i][k] = (unsigned char) qmax;
+		}
+	}
+
+	// The triangles of the leaf children are appended consecutively and
+	// room is made for the interior children, which are built afterwards.
+	const std::vector<Triangle*>& tris = bvh.getTriangles();
+	w.first_triangle = (unsigned int) triangles.size();
+	w.first_child = (unsigned int) nodes.size();
+	int interior = 0;
+	for ( int k = 0; k < n; ++ k ) {
+		const BVHNode& c = binary[children[k]];
+		w.count[k] = (unsigned char) c.count;
+		if ( c.count ) {
+			triangles.insert(triangles.end(),tris.begin()+c.offset,tris.begin()+c.offset+c.count);
+			leaf_count ++;
+		} else {
+			interior ++;
+		}
+	}
+	nodes[node] = w;
+	nodes.resize(nodes.size() + interior);
+
+	interior = 0;
+	for ( int k = 0; k < n; ++ k ) {
+		if ( binary[children[k]].count ) continue;
+		Build(bvh,w.first_child + interior++,children[k],level+1);
+	}
+}
+
+const std::vector<Triangle*>& WideBVH::getTriangles() const {
+	return triangles;
+}
+
+bool WideBVH::RayIntersection(const TriangleStore& store, const gmtl::Rayf& r, float& t, unsigned int& index) const {
+	if ( nodes.empty() ) return false;
+
+	float o[3], inv[3];
+	PrepareRay(r,o,inv);
+
+	StackItem stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = StackItem(0,0,0.0f);
+	bool hit = false;
+	float tmin[WIDE_BVH_WIDTH];
+	StackItem items[WIDE_BVH_WIDTH];
+
+	while ( stack_size ) {
+		const StackItem item = stack[--stack_size];
+		// The box is entered beyond the nearest hit found so far
+		if ( item.t > t ) continue;
+		if ( item.count ) {
+			if ( store.RayIntersection(r,item.index,item.index+item.count,t,index) ) {
+				hit = true;
+			}
+			continue;
+		}
+		const WideBVHNode& node = nodes[item.index];
+		const int mask = IntersectChildren(node,o,inv,t,tmin);
+		if ( !mask ) continue;
+		// The children are pushed from far to near, so that the nearest
+		// child is visited first.
+		for ( int k = ChildItems(node,mask,tmin,items); k > 0; -- k ) {
+			stack[stack_size++] = items[k-1];
+		}
+	}
+	return hit;
+}
+
+bool WideBVH::Occluded(const TriangleStore& store, const gmtl::Point3f& a, const gmtl::Point3f& b) const {
+	if ( nodes.empty() ) return false;
+
+	// The segment is expressed as a ray with an unnormalized direction, so
+	// that the parametric range of the segment is (0,1).
+	const gmtl::Vec3f dir = b - a;
+	const gmtl::Rayf r(a,dir);
+	float o[3], inv[3];
+	PrepareRay(r,o,inv);
+
+	StackItem stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = StackItem(0,0,0.0f);
+	float tmin[WIDE_BVH_WIDTH];
+	StackItem items[WIDE_BVH_WIDTH];
+
+	while ( stack_size ) {
+		const StackItem item = stack[--stack_size];
+		if ( item.count ) {
+			if ( store.LineIntersection(r,item.index,item.index+item.count) ) {
+				return true;
+			}
+			continue;
+		}
+		const WideBVHNode& node = nodes[item.index];
+		const int mask = IntersectChildren(node,o,inv,1.0f,tmin);
+		if ( !mask ) continue;
+		for ( int k = ChildItems(node,mask,tmin,items); k > 0; -- k ) {
+			stack[stack_size++] = items[k-1];
+		}
+	}
+	return false;
+}
+
+unsigned int WideBVH::NodeCount() const {
+	return (unsigned int) nodes.size();
+}
+
+std::string WideBVH::toString() const {
+	std::stringstream ss;
+	ss << std::setprecision(std::cout.precision()) << std::fixed;
+	ss << "Compact hierarchy" << std::endl;
+	ss << " +- nodes: " << nodes.size() << std::endl;
+	ss << " +- children per node: " << WIDE_BVH_WIDTH << std::endl;
+	ss << " +- leaves: " << leaf_count << std::endl;
+	ss << " +- depth: " << depth << std::endl;
+	ss << " +- triangles per leaf: " << (leaf_count ? (float)triangles.size() / leaf_count : 0.0f) << std::endl;
+	return ss.str();
+}
@@ -0,0 +1,96 @@
+/************************************************************************
+ *                                                                      *
+ * This file is part of EAR: Evaluation of Acoustics using Ray-tracing. *
+ *                                                                      *
+ * EAR is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * EAR is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with EAR.  If not, see <http://www.gnu.org/licenses/>.         *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+#include <vector>
+#include <string>
+
+#include <gmtl/Ray.h>
+
+#include "Triangle.h"
+#include "TriangleStore.h"
+#include "BVH.h"
+
+// The number of children of a node of the WideBVH
+#define WIDE_BVH_WIDTH 4
+
+/// A single node of the WideBVH, which holds the bounding boxes of up to
+/// four children. The boxes are quantized to eight bits per coordinate on a
+/// grid that spans the bounds of the node, the grid cell of a coordinate q
+/// along an axis is origin + q * scale. The boxes are rounded outwards, so
+/// that they always enclose the full precision boxes. The node is 64 bytes,
+/// a single cache line, as opposed to 96 bytes for the three binary nodes
+/// it replaces. Leaves do not occupy a node of their own.
+struct WideBVHNode {
+	float origin[3];
+	float scale[3];
+	unsigned char qmin[3][WIDE_BVH_WIDTH];
+	unsigned char qmax[3][WIDE_BVH_WIDTH];
+	/// The index of the node of the first interior child, the interior
+	/// children of a node are stored consecutively.
+	unsigned int first_child;
+	/// The index of the first triangle of the first leaf child, the
+	/// triangles of the leaf children of a node are stored consecutively.
+	unsigned int first_triangle;
+	/// The number of triangles of every child that is a leaf, zero for
+	/// interior children.
+	unsigned char count[WIDE_BVH_WIDTH];
+	/// The number of children, the children occupy the first slots.
+	unsigned char children;
+	unsigned char padding[3];
+};
+
+/// A compact alternative to the BVH for very large models. The binary
+/// hierarchy is collapsed into a hierarchy in which every node has up to
+/// four children, whose bounding boxes are stored at reduced precision
+/// relative to the bounds of their parent. This roughly halves the size of
+/// the hierarchy, so that a larger part of it stays in cache during
+/// traversal, and the four child boxes are tested against a ray at once.
+/// The leaves refer to consecutive ranges of triangles in a TriangleStore
+/// that is created in the order returned by getTriangles(), which differs
+/// from the order of the binary hierarchy.
+class WideBVH {
+private:
+	std::vector<WideBVHNode> nodes;
+	std::vector<Triangle*> triangles;
+	int depth;
+	int leaf_count;
+	void Build(const BVH& bvh, unsigned int node, unsigned int binary_node, int level);
+public:
+	/// Collapses the binary hierarchy, which can be discarded afterwards.
+	WideBVH(const BVH& bvh);
+	/// Returns the triangles in the order of the leaf nodes, which is the
+	/// order in which they need to be copied into the triangle store.
+	const std::vector<Triangle*>& getTriangles() const;
+	/// Returns the index in the store of the nearest triangle hit by the
+	/// ray for which the parametric distance t lies within (0.001, t), like
+	/// BVH::RayIntersection().
+	bool RayIntersection(const TriangleStore& store, const gmtl::Rayf& r, float& t, unsigned int& index) const;
+	/// Returns whether any triangle intersects the line segment between a
+	/// and b, like BVH::Occluded().
+	bool Occluded(const TriangleStore& store, const gmtl::Point3f& a, const gmtl::Point3f& b) const;
+	/// Returns the number of nodes in the hierarchy.
+	unsigned int NodeCount() const;
+	/// Returns a textual summary of the hierarchy.
+	std::string toString() const;
+};
+
+#endif